@@ -14,6 +14,10 @@
 
 #include "MicroMojo.h"
 #include "../../MMDevice/ModuleInterface.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
 
 #ifdef WIN32
 #include <windows.h>
@@ -26,29 +30,114 @@ const char* g_DeviceNameMojoInput = "Mojo-Input";
 const char* g_DeviceNameMojoPWM = "Mojo-PWM";
 const char* g_DeviceNameMojoTTL = "Mojo-TTL";
 const char* g_DeviceNameMojoServos = "Mojo-Servos";
+const char* g_DeviceNameMojoCameraTrigger = "Mojo-CameraTrigger";
+const char* g_DeviceNameMojoLaserShutter = "Mojo-LaserShutter";
 
 //////////////////////////////////////////////////////////////////////////////
 /// Constants that should match the one in the firmware
-const int g_version = 1;
 
-const int g_maxlasers = 6;
+// Register maps of the supported firmware, the hub reads the version register
+// of each of them at Initialize and uses the first that answers its version
+const MojoRegisterMap g_registerMaps[] = {
+	// v1: Alchitry_projects/Mojo_v1
+	{1, 100, -1, 38730,
+	 6, 6, 6, 6, 8, 65535,
+	 0, 10, 20, 30, 40, 50, 60,
+	 -1, -1, -1, -1, -1, -1,
+	 -1, -1, -1, -1,
+	 -1, -1, -1,
+	 -1, -1, -1, -1, -1},
+	// v3: Alchitry_projects/Mojo_v3
+	{3, 200, 201, 11206655,
+	 8, 4, 7, 5, 8, 1048575,
+	 0, 8, 16, 24, 28, 35, 46,
+	 40, 41, 42, 43, 44, 45,
+	 54, 58, 59,
+	 60, 61, 62,
+	 63, 64, 65, 66, 67, 202}
+};
+const int g_numRegisterMaps = sizeof(g_registerMaps) / sizeof(g_registerMaps[0]);
+
+// Registers added to a firmware version after its first release, probed
+// with the version (the frames remaining come with the frame count, the
+// timestamps with the frame counter, the sample queue with its channel mask)
+long MojoRegisterMap::* const g_optionalRegisters[] = {&MojoRegisterMap::ttlSequence, &MojoRegisterMap::frameCount,
+	&MojoRegisterMap::frameCounter, &MojoRegisterMap::sampleChannels, &MojoRegisterMap::sequenceRestart};
+const int g_numOptionalRegisters = sizeof(g_optionalRegisters) / sizeof(g_optionalRegisters[0]);
+
+// Largest number of boards driven by a hub
+const int g_maxBoards = 4;
+
+// Largest number of channels over the supported firmware and the boards of
+// a hub, the peripherals check the actual number against the register map
+// at Initialize
+const int g_maxlasers = 8 * g_maxBoards;
 const int g_maxanaloginput = 8;
-const int g_maxttl = 6;
-const int g_maxpwm = 6;
-const int g_maxservos = 6;
-
-const int g_offsetaddressLaserMode = 0;
-const int g_offsetaddressLaserDuration = 10;
-const int g_offsetaddressLaserSequence = 20;
-const int g_offsetaddressTTL = 30;
-const int g_offsetaddressServo = 40;
-const int g_offsetaddressPWM = 50;
-const int g_offsetaddressAnalogInput = 60;
-
-const int g_address_version = 100;
-
-// static lock
-MMThreadLock MojoHub::lock_;
+const int g_maxttl = 6 * g_maxBoards;
+const int g_maxpwm = 6 * g_maxBoards;
+const int g_maxservos = 7 * g_maxBoards;
+
+// The reg_interface header byte holds a write flag (bit 7), an auto-increment
+// flag (bit 6) and the number of consecutive words minus one (bits 5:0)
+const int g_maxBurstLength = 64;
+
+// Analog sample stream: samples read from the queue of the board per
+// transaction, period of the polls once the queue is empty, and capacity of
+// the ring of the samples not read yet (seconds at the usual rates)
+const long g_streamBurstWords = 512;
+const double g_streamPollMs = 2.;
+const size_t g_streamCapacity = 1 << 16;
+
+// Size of the shadow register file kept by the hub
+const int g_maxRegisters = 256;
+
+// Capacity reserved for the frames of a write batch, about a hundred writes
+const size_t g_batchCapacity = 1024;
+
+// Board detection: the version handshake is repeated until the board
+// answers, each attempt waits at most the time out
+const int g_detectAttempts = 3;
+const double g_detectTimeoutMs = 100.;
+
+// Number of registers requested before their answers are collected in a
+// pipelined read, so that the answers fit in the serial buffers
+const long g_maxPipelinedWords = 128;
+
+// Registers of a preset are written again when a single unchanged register
+// separates two changed ones: a word costs less than a burst header
+const long g_presetMaxGap = 1;
+
+// First line of a preset file
+const char* g_presetFileHeader = "mojo-presets";
+
+// Framed protocol (reg_frame_interface.luc): marker preceding the sequence
+// number of a request, bit of the protocol register, flags of the answers
+// and number of writes left unacknowledged before the hub waits for their
+// acknowledgements. With the reads of a pipelined window, the requests in
+// flight stay below the 256 sequence numbers.
+const unsigned char g_frameMarker = 0xA5;
+const long g_protocolFramed = 1;
+const unsigned char g_frameWrite = (1 << 7);
+const unsigned char g_frameUnknown = 1;
+const size_t g_maxFramesInFlight = 32;
+
+// Values of the hub Transport property
+const char* g_transportSerial = "Serial port";
+const char* g_transportSimulatorV1 = "Simulator v1";
+const char* g_transportSimulatorV3 = "Simulator v3";
+const char* g_transportTty = "Native tty";
+const char* g_transportTcp = "TCP bridge";
+
+// Values of the hub Protocol property
+const char* g_protocolLegacyName = "Legacy";
+const char* g_protocolFramedName = "Framed";
+
+// Read-only counters of the hub I/O path
+const char* g_metricsCounters[] = {"Metrics read transactions", "Metrics write transactions",
+	"Metrics bytes sent", "Metrics bytes received", "Metrics timeouts", "Metrics unknown commands"};
+
+std::string MojoHub::lastGoodPort_;
+std::mutex MojoHub::lastGoodPortMutex_;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Exported MMDevice API
@@ -61,6 +150,8 @@ MODULE_API void InitializeModuleData()
 	RegisterDevice(g_DeviceNameMojoPWM, MM::GenericDevice, "PWM Output");
 	RegisterDevice(g_DeviceNameMojoTTL, MM::GenericDevice, "TTL Output");
 	RegisterDevice(g_DeviceNameMojoServos, MM::GenericDevice, "Servos");
+	RegisterDevice(g_DeviceNameMojoCameraTrigger, MM::GenericDevice, "Camera Trigger");
+	RegisterDevice(g_DeviceNameMojoLaserShutter, MM::ShutterDevice, "Laser Shutter");
 }
 
 MODULE_API MM::Device* CreateDevice(const char* deviceName)
@@ -92,6 +183,14 @@ MODULE_API MM::Device* CreateDevice(const char* deviceName)
 	{
 		return new MojoServo;
 	}
+	else if (strcmp(deviceName, g_DeviceNameMojoCameraTrigger) == 0)
+	{
+		return new MojoCameraTrigger;
+	}
+	else if (strcmp(deviceName, g_DeviceNameMojoLaserShutter) == 0)
+	{
+		return new MojoLaserShutter;
+	}
 
 	return 0;
 }
@@ -106,24 +205,149 @@ MODULE_API void DeleteDevice(MM::Device* pDevice)
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~
 //
 MojoHub::MojoHub() :
-	initialized_ (false)
+	initialized_ (false),
+	transportName_(g_transportSerial),
+	transport_(0),
+	ownedTransport_(0),
+	ttyDevice_("/dev/ttyACM0"),
+	bridgeHost_("localhost"),
+	bridgePort_(5555),
+	boardID_(0),
+	map_(0),
+	shadow_(g_maxRegisters, 0),
+	shadowValid_(g_maxRegisters, false),
+	shadowPending_(g_maxRegisters, 0),
+	ioRunning_(false),
+	stopIO_(false),
+	batchDepth_(0),
+	batchProperty_(false),
+	batchClient_(MojoMetrics::ClientHub),
+	metricsFile_("MojoMetrics.txt"),
+	ioClient_(MojoMetrics::ClientHub),
+	protocolName_(g_protocolLegacyName),
+	framed_(false),
+	sequence_(0),
+	numBoards_(1),
+	boardTransport_(g_maxBoards, g_transportSerial),
+	boardPort_(g_maxBoards, "Undefined"),
+	presetName_("Preset"),
+	presetFile_("MojoPresets.txt"),
+	startupPreset_("None")
 {
+	ioMetrics_ = &metrics_;
 	portAvailable_ = false;
 
+	// a board already found in this session is proposed again
+	{
+		std::lock_guard<std::mutex> guard(lastGoodPortMutex_);
+		port_ = lastGoodPort_.empty() ? "Undefined" : lastGoodPort_;
+	}
+	batchFrame_.reserve(g_batchCapacity);
+
 	InitializeDefaultErrorMessages();
 	SetErrorText(ERR_PORT_OPEN_FAILED, "Failed opening Mojo USB device");
 	SetErrorText(ERR_BOARD_NOT_FOUND, "Did not find an Mojo board with the correct firmware. Is the Mojo board connected to this serial port?");
 	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
-	SetErrorText(ERR_VERSION_MISMATCH, "The firmware version on the Mojo is not compatible with this adapter. Please use firmware version 1.");
+	SetErrorText(ERR_VERSION_MISMATCH, "The firmware version on the Mojo is not compatible with this adapter. Please use firmware version 1 or 3.");
 	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	SetErrorText(ERR_METRICS_FILE, "Could not write the metrics file.");
+	SetErrorText(ERR_PRESET_UNKNOWN, "There is no preset with this name.");
+	SetErrorText(ERR_PRESET_FILE, "Could not read or write the preset file, or it was written for another register map.");
 
 	CPropertyAction* pAct = new CPropertyAction(this, &MojoHub::OnPort);
-	CreateProperty(MM::g_Keyword_Port, "Undefined", MM::String, false, pAct, true);
+	CreateProperty(MM::g_Keyword_Port, port_.c_str(), MM::String, false, pAct, true);
+
+	// The simulator runs the firmware register map in software, the latencies
+	// allow reproducing the USB timing of a real board
+	pAct = new CPropertyAction(this, &MojoHub::OnTransport);
+	CreateProperty("Transport", g_transportSerial, MM::String, false, pAct, true);
+	AddAllowedValue("Transport", g_transportSerial);
+	AddAllowedValue("Transport", g_transportSimulatorV1);
+	AddAllowedValue("Transport", g_transportSimulatorV3);
+#ifndef WIN32
+	AddAllowedValue("Transport", g_transportTty);
+#endif
+	AddAllowedValue("Transport", g_transportTcp);
+
+	simulatorLatencyUs_[0] = 0.;
+	simulatorLatencyUs_[1] = 0.;
+
+	CPropertyActionEx* pExAct = new CPropertyActionEx(this, &MojoHub::OnSimulatorLatency, 0);
+	CreateProperty("Simulator transaction latency (us)", "0", MM::Float, false, pExAct, true);
+	SetPropertyLimits("Simulator transaction latency (us)", 0, 100000);
+
+	pExAct = new CPropertyActionEx(this, &MojoHub::OnSimulatorLatency, 1);
+	CreateProperty("Simulator byte latency (us)", "0", MM::Float, false, pExAct, true);
+	SetPropertyLimits("Simulator byte latency (us)", 0, 10000);
+
+#ifndef WIN32
+	// The native tty transport opens the board device directly and sleeps in
+	// poll() while waiting for the answers
+	pAct = new CPropertyAction(this, &MojoHub::OnTtyDevice);
+	CreateProperty("Tty device", ttyDevice_.c_str(), MM::String, false, pAct, true);
+#endif
+
+	// The TCP bridge reaches a board plugged in another computer running MojoBridge
+	pAct = new CPropertyAction(this, &MojoHub::OnBridgeHost);
+	CreateProperty("Bridge host", bridgeHost_.c_str(), MM::String, false, pAct, true);
+
+	pAct = new CPropertyAction(this, &MojoHub::OnBridgePort);
+	CreateProperty("Bridge port", "5555", MM::Integer, false, pAct, true);
+	SetPropertyLimits("Bridge port", 1, 65535);
+
+	// Several boards are driven as one: the devices see the channels of the
+	// first board, then those of the second board... The first board is set
+	// by the properties above, the port of the others is the serial port,
+	// the tty device or the bridge host:port depending on their transport.
+	pAct = new CPropertyAction(this, &MojoHub::OnNumberOfBoards);
+	CreateProperty("Number of boards", "1", MM::Integer, false, pAct, true);
+	SetPropertyLimits("Number of boards", 1, g_maxBoards);
+
+	for(long b=1;b<g_maxBoards;b++){
+		std::ostringstream transport, port;
+		transport << "Board" << b << " transport";
+		port << "Board" << b << " port";
+
+		pExAct = new CPropertyActionEx(this, &MojoHub::OnBoardTransport, b);
+		CreateProperty(transport.str().c_str(), g_transportSerial, MM::String, false, pExAct, true);
+		AddAllowedValue(transport.str().c_str(), g_transportSerial);
+		AddAllowedValue(transport.str().c_str(), g_transportSimulatorV1);
+		AddAllowedValue(transport.str().c_str(), g_transportSimulatorV3);
+#ifndef WIN32
+		AddAllowedValue(transport.str().c_str(), g_transportTty);
+#endif
+		AddAllowedValue(transport.str().c_str(), g_transportTcp);
+
+		pExAct = new CPropertyActionEx(this, &MojoHub::OnBoardPort, b);
+		CreateProperty(port.str().c_str(), "Undefined", MM::String, false, pExAct, true);
+	}
+
+	// Framed requests carry a sequence number and are all answered with a
+	// status, the hub keeps many of them in flight without purging the port.
+	// Used if the firmware supports them, the legacy requests otherwise.
+	pAct = new CPropertyAction(this, &MojoHub::OnProtocol);
+	CreateProperty("Protocol", g_protocolLegacyName, MM::String, false, pAct, true);
+	AddAllowedValue("Protocol", g_protocolLegacyName);
+	AddAllowedValue("Protocol", g_protocolFramedName);
+
+	// A rig comes up in a known state: the preset file is loaded and the
+	// startup preset applied at Initialize
+	pAct = new CPropertyAction(this, &MojoHub::OnPresetFile);
+	CreateProperty("Preset file", presetFile_.c_str(), MM::String, false, pAct, true);
+
+	pAct = new CPropertyAction(this, &MojoHub::OnStartupPreset);
+	CreateProperty("Startup preset", startupPreset_.c_str(), MM::String, false, pAct, true);
+
+	requestBuffer_.reserve(5 * g_maxPipelinedWords);
 }
 
 MojoHub::~MojoHub()
 {
 	Shutdown();
+
+	for(size_t i=0;i<readPool_.size();i++){
+		delete readPool_[i];
+	}
 }
 
 void MojoHub::GetName(char* name) const
@@ -133,6 +357,16 @@ void MojoHub::GetName(char* name) const
 
 bool MojoHub::Busy()
 {
+	for(size_t b=0;b<boards_.size();b++){
+		if (boards_[b]->Busy())
+			return true;
+	}
+
+	std::lock_guard<std::mutex> guard(queueMutex_);
+	for(std::map<const MM::Device*, int>::const_iterator it = pendingCommands_.begin(); it != pendingCommands_.end(); ++it){
+		if (it->second > 0)
+			return true;
+	}
 	return false;
 }
 
@@ -161,22 +395,25 @@ MM::DeviceDetectionStatus MojoHub::DetectDevice(void)
 			GetCoreCallback()->SetDeviceProperty(port_.c_str(), MM::g_Keyword_Handshaking, "0");
 			GetCoreCallback()->SetDeviceProperty(port_.c_str(), MM::g_Keyword_BaudRate, "9600" );
 			GetCoreCallback()->SetDeviceProperty(port_.c_str(), MM::g_Keyword_StopBits, "1");
-			GetCoreCallback()->SetDeviceProperty(port_.c_str(), "AnswerTimeout", "500.0");
+			GetCoreCallback()->SetDeviceProperty(port_.c_str(), "AnswerTimeout", "100.0");
 			GetCoreCallback()->SetDeviceProperty(port_.c_str(), "DelayBetweenCharsMs", "0");
 			MM::Device* pS = GetCoreCallback()->GetDevice(this, port_.c_str());
 			pS->Initialize();
 
-			CDeviceUtils::SleepMs(100);
-			MMThreadGuard myLock(lock_);
-			PurgeComPort(port_.c_str());
+			// Short version handshake instead of a fixed wait for the port to
+			// settle. The probe leaves the hub state and the static lock
+			// alone, so that the detections of several ports run in parallel.
 			long v = 0;
-			int ret = GetControllerVersion(v);
+			int ret = ProbeVersion(port_, v);
 
 			if( DEVICE_OK != ret ){
 				LogMessageCode(ret,true);
 			} else {
 				// to succeed must reach here....
 				result = MM::CanCommunicate;
+
+				std::lock_guard<std::mutex> guard(lastGoodPortMutex_);
+				lastGoodPort_ = port_;
 			}
 			pS->Shutdown();
 			// always restore the AnswerTimeout to the default
@@ -202,18 +439,13 @@ int MojoHub::Initialize()
 	if (DEVICE_OK != ret)
 		return ret;
 
-	MMThreadGuard myLock(lock_);
-
-	PurgeComPort(port_.c_str());
-
-	// Get controller version
-	ret = GetControllerVersion(version_);
-	if( DEVICE_OK != ret)
+	ret = numBoards_ > 1 ? ConnectBoards() : ConnectBoard();
+	if (ret != DEVICE_OK)
 		return ret;
 
-	// Verify that the version of the firmware and adapter match
-	if (g_version != version_){
-		return ERR_VERSION_MISMATCH;
+	if (boards_.empty() && transportName_ == g_transportSerial && transport_ == ownedTransport_){
+		std::lock_guard<std::mutex> guard(lastGoodPortMutex_);
+		lastGoodPort_ = port_;
 	}
 
 	CPropertyAction* pAct = new CPropertyAction(this, &MojoHub::OnVersion);
@@ -221,6 +453,103 @@ int MojoHub::Initialize()
 	sversion << version_;
 	CreateProperty("MicroMojo version", sversion.str().c_str(), MM::Integer, true, pAct);
 
+	if (map_->idAddress >= 0){
+		pAct = new CPropertyAction(this, &MojoHub::OnBoardID);
+		std::ostringstream sid;
+		sid << boardID_;
+		CreateProperty("Board ID", sid.str().c_str(), MM::Integer, true, pAct);
+	}
+
+	// framed if all the boards use framed requests
+	bool framed = boards_.empty() ? framed_ : true;
+	for(size_t b=0;b<boards_.size();b++){
+		framed = framed && boards_[b]->framed_;
+	}
+	CreateProperty("Protocol in use", framed ? g_protocolFramedName : g_protocolLegacyName, MM::String, true);
+
+	// Registers are served from the shadow register file, this reloads it from the board
+	pAct = new CPropertyAction(this, &MojoHub::OnResync);
+	CreateProperty("Resync registers", "Idle", MM::String, false, pAct);
+	AddAllowedValue("Resync registers", "Idle");
+	AddAllowedValue("Resync registers", "Resync");
+
+	// Presets of the registers of all the devices
+	pAct = new CPropertyAction(this, &MojoHub::OnPresetName);
+	CreateProperty("Preset name", presetName_.c_str(), MM::String, false, pAct);
+
+	pAct = new CPropertyAction(this, &MojoHub::OnPreset);
+	CreateProperty("Preset", "Idle", MM::String, false, pAct);
+	AddAllowedValue("Preset", "Idle");
+	AddAllowedValue("Preset", "Store");
+	AddAllowedValue("Preset", "Apply");
+	AddAllowedValue("Preset", "Delete");
+
+	pAct = new CPropertyAction(this, &MojoHub::OnPresetFileAction);
+	CreateProperty("Preset file action", "Idle", MM::String, false, pAct);
+	AddAllowedValue("Preset file action", "Idle");
+	AddAllowedValue("Preset file action", "Save");
+	AddAllowedValue("Preset file action", "Load");
+
+	pAct = new CPropertyAction(this, &MojoHub::OnPresets);
+	CreateProperty("Presets", "", MM::String, true, pAct);
+
+	// Writes of all devices are held while set to 1, and sent in a single
+	// transfer when set back to 0
+	pAct = new CPropertyAction(this, &MojoHub::OnBatchWrites);
+	CreateProperty("Batch writes", "0", MM::Integer, false, pAct);
+	AddAllowedValue("Batch writes", "0");
+	AddAllowedValue("Batch writes", "1");
+
+	// Metrics of the I/O path
+	for(int i=0;i<6;i++){
+		pAct = new CPropertyAction(this, &MojoHub::OnMetricsCounter);
+		CreateProperty(g_metricsCounters[i], "0", MM::Integer, true, pAct);
+	}
+
+	for(int op=0;op<MojoMetrics::NumOperations;op++){
+		for(int range=0;range<MojoMetrics::NumRanges;range++){
+			std::ostringstream name;
+			name << "Metrics latency " << MojoMetrics::GetRangeName(static_cast<MojoMetrics::Range>(range))
+				<< " " << MojoMetrics::GetOperationName(static_cast<MojoMetrics::Operation>(op));
+
+			CPropertyActionEx* pExAct = new CPropertyActionEx(this, &MojoHub::OnMetricsLatency, op * MojoMetrics::NumRanges + range);
+			CreateProperty(name.str().c_str(), "n=0", MM::String, true, pExAct);
+		}
+	}
+
+	// Time waited for the I/O lock and held, per type of device
+	for(int time=0;time<MojoMetrics::NumLockTimes;time++){
+		for(int client=0;client<MojoMetrics::NumClients;client++){
+			std::ostringstream name;
+			name << "Metrics lock " << MojoMetrics::GetLockTimeName(static_cast<MojoMetrics::LockTime>(time))
+				<< " " << MojoMetrics::GetClientName(static_cast<MojoMetrics::Client>(client));
+
+			CPropertyActionEx* pExAct = new CPropertyActionEx(this, &MojoHub::OnMetricsLock, time * MojoMetrics::NumClients + client);
+			CreateProperty(name.str().c_str(), "n=0", MM::String, true, pExAct);
+		}
+	}
+
+	pAct = new CPropertyAction(this, &MojoHub::OnMetricsFile);
+	CreateProperty("Metrics file", metricsFile_.c_str(), MM::String, false, pAct);
+
+	pAct = new CPropertyAction(this, &MojoHub::OnMetricsAction);
+	CreateProperty("Metrics", "Idle", MM::String, false, pAct);
+	AddAllowedValue("Metrics", "Idle");
+	AddAllowedValue("Metrics", "Dump");
+	AddAllowedValue("Metrics", "Reset");
+
+	// From now on, all transactions go through the I/O thread (of each board)
+	if (boards_.empty())
+		StartIOThread();
+
+	if (startupPreset_ != "None"){
+		ret = LoadPresets(presetFile_);
+		if (ret == DEVICE_OK)
+			ret = ApplyPreset(startupPreset_);
+		if (ret != DEVICE_OK)
+			return ret;
+	}
+
 	initialized_ = true;
 	return DEVICE_OK;
 }
@@ -233,10 +562,13 @@ int MojoHub::DetectInstalledDevices()
 		std::vector<std::string> peripherals; 
 		peripherals.clear();
 		peripherals.push_back(g_DeviceNameMojoLaserTrig);
+		peripherals.push_back(g_DeviceNameMojoLaserShutter);
 		peripherals.push_back(g_DeviceNameMojoInput);
 		peripherals.push_back(g_DeviceNameMojoPWM);
 		peripherals.push_back(g_DeviceNameMojoTTL);
 		peripherals.push_back(g_DeviceNameMojoServos);
+		if (map_ != 0 && map_->activeTrigger >= 0)
+			peripherals.push_back(g_DeviceNameMojoCameraTrigger);
 		for (size_t i=0; i < peripherals.size(); i++) 
 		{
 			MM::Device* pDev = ::CreateDevice(peripherals[i].c_str());
@@ -252,583 +584,4449 @@ int MojoHub::DetectInstalledDevices()
 
 int MojoHub::Shutdown()
 {
+	// send the writes of an unfinished batch
+	{
+		std::lock_guard<std::mutex> guard(queueMutex_);
+		batchDepth_ = 0;
+		batchProperty_ = false;
+	}
+	Enqueue(0);
+
+	StopIOThread();
+
+	// each board sends the rest of its batch and stops its I/O thread
+	for(size_t b=0;b<boards_.size();b++){
+		delete boards_[b];
+	}
+	boards_.clear();
+	segments_.clear();
+
+	if (ownedTransport_){
+		if (transport_ == ownedTransport_)
+			transport_ = 0;
+		delete ownedTransport_;
+		ownedTransport_ = 0;
+	}
+
 	initialized_ = false;
 	return DEVICE_OK;
 }
 
-int MojoHub::GetControllerVersion(long& version)
+int MojoHub::CreateTransport(const std::string& name, const std::string& address, MojoTransport*& transport)
 {
-	int ret = SendReadRequest(g_address_version);
-	if (ret != DEVICE_OK)
-		return ret;
+	// <address> is the serial port, the tty device or the bridge host:port
+	transport = 0;
+	if (name == g_transportSimulatorV1 || name == g_transportSimulatorV3){
+		MojoSimulator* simulator = new MojoSimulator(name == g_transportSimulatorV1 ? MojoSimulator::Layout_v1 : MojoSimulator::Layout_v3);
+		simulator->SetLatency(simulatorLatencyUs_[0], simulatorLatencyUs_[1]);
+		transport = simulator;
+	} else if (name == g_transportTty){
+		MojoTty* tty = new MojoTty;
+		if (tty->Open(address) != DEVICE_OK){
+			delete tty;
+			return ERR_PORT_OPEN_FAILED;
+		}
+		transport = tty;
+	} else if (name == g_transportTcp){
+		std::string host = address;
+		long port = bridgePort_;
+		const size_t colon = address.rfind(':');
+		if (colon != std::string::npos){
+			host = address.substr(0, colon);
+			port = atol(address.substr(colon + 1).c_str());
+		}
 
-	ret = ReadAnswer(version);
-	if (ret != DEVICE_OK)
-		return ret;
+		MojoTcp* tcp = new MojoTcp;
+		if (tcp->Connect(host, port) != DEVICE_OK){
+			delete tcp;
+			return ERR_PORT_OPEN_FAILED;
+		}
+		transport = tcp;
+	} else {
+		transport = new MojoSerialPort(GetCoreCallback(), this, address);
+	}
 
-	return ret;
+	return DEVICE_OK;
 }
 
-int MojoHub::SendWriteRequest(long address, long value)
-{   
-	unsigned char command[9];
-	command[0] = (1 << 7);	// 1 = write
-	command[1] = static_cast<char>(address);	// put the least significant byte
-	command[2] = static_cast<char>((address >> 8));	// put the least but one significant byte 
-	command[3] = static_cast<char>((address >> 16));	
-	command[4] = static_cast<char>((address >> 24)); // address and value are 32 bits long
-	command[5] = static_cast<char>(value);	
-	command[6] = static_cast<char>((value >> 8));	
-	command[7] = static_cast<char>((value >> 16));	
-	command[8] = static_cast<char>((value >> 24));	
-
-	int ret = WriteToComPortH((const unsigned char*) command, 9);
-
-	return ret;
-}
-int MojoHub::SendReadRequest(long address){
-	unsigned char command[5];
-	command[0] = (0 << 7);	
-	command[1] = static_cast<char>(address);	
-	command[2] = static_cast<char>((address >> 8));	
-	command[3] = static_cast<char>((address >> 16));	
-	command[4] = static_cast<char>((address >> 24));
+std::string MojoHub::GetTransportAddress() const
+{
+	if (transportName_ == g_transportTty)
+		return ttyDevice_;
 
-	int ret = WriteToComPortH((const unsigned char*) command, 5);
+	if (transportName_ == g_transportTcp){
+		std::ostringstream address;
+		address << bridgeHost_ << ":" << bridgePort_;
+		return address.str();
+	}
 
-	return ret;
+	return port_;
 }
 
-int MojoHub::ReadAnswer(long& ans){
-	unsigned char* answer = new unsigned char[4];
-	
-	// Code adapted from Arduino.cpp, Micro-Manager, written by Nico Stuurman and Karl Hoover
-	MM::MMTime startTime = GetCurrentMMTime();  
-	unsigned long bytesRead = 0;
-
-	while ((bytesRead < 4) && ( (GetCurrentMMTime() - startTime).getMsec() < 500)) {
-		unsigned long bR;
-		int ret = ReadFromComPortH(answer + bytesRead, 4 - bytesRead, bR);
+int MojoHub::ConnectBoard()
+{
+	if (transport_ == 0){
+		int ret = CreateTransport(transportName_, GetTransportAddress(), ownedTransport_);
 		if (ret != DEVICE_OK)
 			return ret;
-		bytesRead += bR;
+		transport_ = ownedTransport_;
 	}
 
-	// Format answer
-	int tmp = answer[3];
-	for(int i=1;i<4;i++){
-		tmp = tmp << 8;
-		tmp = tmp | answer[3-i];
+	{
+		MojoIOGuard guard(lock_, *ioMetrics_, MojoMetrics::ClientHub);
+		PurgeComPortH();
 	}
 
-	ans = tmp;
+	// Get controller version, this selects the register map
+	int ret = GetControllerVersion(version_);
+	if( DEVICE_OK != ret)
+		return ret;
+
+	ret = NegotiateProtocol();
+	if (ret != DEVICE_OK)
+		return ret;
 
-	// If unknown command answer
-	if(ans == ERR_COMMAND_UNKNOWN){
-		return ERR_COMMAND_UNKNOWN;
+	if (map_->idAddress >= 0){
+		ret = ReadBlock(map_->idAddress, 1, &boardID_);
+		if (ret != DEVICE_OK)
+			return ret;
 	}
 
+	InvalidateRegisters();
 	return DEVICE_OK;
 }
 
-int MojoHub::OnPort(MM::PropertyBase* pProp, MM::ActionType pAct)
+int MojoHub::ConnectBoards()
 {
-	if (pAct == MM::BeforeGet)
-	{
-		pProp->Set(port_.c_str());
+	// Each board is a hub of its own that is not known to the core, with its
+	// transport, its register map and its I/O thread. They all report to the
+	// metrics of this hub.
+	for(long b=0;b<numBoards_;b++){
+		MojoHub* board = new MojoHub;
+		board->SetCallback(GetCoreCallback());
+		board->ioMetrics_ = &metrics_;
+		board->protocolName_ = protocolName_;
+		boards_.push_back(board);
+
+		int ret = DEVICE_OK;
+		if (b == 0 && transport_ != 0){
+			board->transport_ = transport_;
+		} else if (b == 0){
+			ret = CreateTransport(transportName_, GetTransportAddress(), board->ownedTransport_);
+		} else {
+			ret = CreateTransport(boardTransport_[b], boardPort_[b], board->ownedTransport_);
+		}
+		if (ret != DEVICE_OK)
+			return ret;
+		if (board->transport_ == 0)
+			board->transport_ = board->ownedTransport_;
+
+		ret = board->ConnectBoard();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		board->StartIOThread();
 	}
-	else if (pAct == MM::AfterSet)
-	{
-		pProp->Get(port_);
-		portAvailable_ = true;
+
+	// Aggregated register map: the channels of each block are numbered
+	// across the boards, the camera trigger, the version and the sample
+	// stream are those of the first board
+	const MojoRegisterMap& first = *boards_[0]->map_;
+	registerMap_ = first;
+	segments_.clear();
+
+	long next = 0;
+	AddAggregatedBlock(&MojoRegisterMap::laserMode, &MojoRegisterMap::maxLasers, next);
+	AddAggregatedBlock(&MojoRegisterMap::laserDuration, &MojoRegisterMap::maxLasers, next);
+	AddAggregatedBlock(&MojoRegisterMap::laserSequence, &MojoRegisterMap::maxLasers, next);
+	AddAggregatedBlock(&MojoRegisterMap::ttl, &MojoRegisterMap::maxTTL, next);
+	AddAggregatedBlock(&MojoRegisterMap::servo, &MojoRegisterMap::maxServos, next);
+	AddAggregatedBlock(&MojoRegisterMap::pwm, &MojoRegisterMap::maxPWM, next);
+
+	if (first.activeTrigger >= 0){
+		AddAggregatedRegister(&MojoRegisterMap::activeTrigger, next);
+		AddAggregatedRegister(&MojoRegisterMap::startTrigger, next);
+		AddAggregatedRegister(&MojoRegisterMap::cameraPulse, next);
+		AddAggregatedRegister(&MojoRegisterMap::cameraReadout, next);
+		AddAggregatedRegister(&MojoRegisterMap::cameraExposure, next);
+		AddAggregatedRegister(&MojoRegisterMap::laserDelay, next);
 	}
-	return DEVICE_OK;
-}
 
-int MojoHub::OnVersion(MM::PropertyBase* pProp, MM::ActionType pAct)
-{
-	if (pAct == MM::BeforeGet)
-	{
-		pProp->Set((long)version_);
+	AddAggregatedBlock(&MojoRegisterMap::analogInput, &MojoRegisterMap::maxAnalogInput, next);
+
+	// the TTL patterns only if all the boards have them
+	bool patterns = true;
+	for(size_t b=0;b<boards_.size();b++){
+		registerMap_.maxDuration = std::min(registerMap_.maxDuration, boards_[b]->map_->maxDuration);
+		patterns = patterns && boards_[b]->map_->ttlSequence >= 0;
+	}
+	if (patterns)
+		AddAggregatedBlock(&MojoRegisterMap::ttlSequence, &MojoRegisterMap::maxTTL, next);
+	else
+		registerMap_.ttlSequence = -1;
+
+	AddAggregatedRegister(&MojoRegisterMap::versionAddress, next);
+	if (first.idAddress >= 0)
+		AddAggregatedRegister(&MojoRegisterMap::idAddress, next);
+	if (first.frameCount >= 0){
+		AddAggregatedRegister(&MojoRegisterMap::frameCount, next);
+		AddAggregatedRegister(&MojoRegisterMap::framesRemaining, next);
 	}
+	if (first.frameCounter >= 0){
+		AddAggregatedRegister(&MojoRegisterMap::frameCounter, next);
+		AddAggregatedRegister(&MojoRegisterMap::timestampLevel, next);
+		AddAggregatedRegister(&MojoRegisterMap::timestamp, next);
+	}
+	if (first.sampleChannels >= 0){
+		AddAggregatedRegister(&MojoRegisterMap::sampleChannels, next);
+		AddAggregatedRegister(&MojoRegisterMap::sampleDivider, next);
+		AddAggregatedRegister(&MojoRegisterMap::sampleLevel, next);
+		AddAggregatedRegister(&MojoRegisterMap::sample, next);
+	}
+
+	// the sequence restart of every board, one after the other, so that the
+	// sequences of all the boards start on the same frame
+	bool restart = true;
+	for(size_t b=0;b<boards_.size();b++){
+		restart = restart && boards_[b]->map_->sequenceRestart >= 0;
+	}
+	if (restart){
+		registerMap_.sequenceRestart = next;
+		for(size_t b=0;b<boards_.size();b++){
+			Segment s;
+			s.address = next++;
+			s.count = 1;
+			s.board = b;
+			s.reg = boards_[b]->map_->sequenceRestart;
+			segments_.push_back(s);
+		}
+	} else {
+		registerMap_.sequenceRestart = -1;
+	}
+
+	map_ = &registerMap_;
+	version_ = boards_[0]->version_;
+	boardID_ = boards_[0]->boardID_;
+
 	return DEVICE_OK;
 }
 
-
-///////////////////////////////////////////////////////////////////////////////////////////
-//////
-MojoLaserTrig::MojoLaserTrig() :
-initialized_ (false),
-	busy_(false)
+void MojoHub::AddAggregatedBlock(long MojoRegisterMap::* base, int MojoRegisterMap::* count, long& next)
 {
-	InitializeDefaultErrorMessages();
+	registerMap_.*base = next;
 
-	// Custom error messages
-	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
-	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	int total = 0;
+	for(size_t b=0;b<boards_.size();b++){
+		const MojoRegisterMap& map = *boards_[b]->map_;
 
-	// Description
-	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo laser triggering system", MM::String, true);
-	assert(DEVICE_OK == ret);
+		Segment s;
+		s.address = next;
+		s.count = map.*count;
+		s.board = b;
+		s.reg = map.*base;
+		segments_.push_back(s);
 
-	// Name
-	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoLaserTrig, MM::String, true);
-	assert(DEVICE_OK == ret);
+		next += s.count;
+		total += map.*count;
+	}
 
-	// Number of lasers
-	CPropertyAction* pAct = new CPropertyAction(this, &MojoLaserTrig::OnNumberOfLasers);
-	CreateProperty("Number of lasers", "4", MM::Integer, false, pAct, true);
-	SetPropertyLimits("Number of lasers", 1, g_maxlasers);
+	registerMap_.*count = total;
 }
 
-
-MojoLaserTrig::~MojoLaserTrig()
+void MojoHub::AddAggregatedRegister(long MojoRegisterMap::* address, long& next)
 {
-	Shutdown();
+	Segment s;
+	s.address = next;
+	s.count = 1;
+	s.board = 0;
+	s.reg = boards_[0]->map_->*address;
+	segments_.push_back(s);
+
+	registerMap_.*address = next++;
 }
 
-void MojoLaserTrig::GetName(char* name) const
+bool MojoHub::Translate(long address, size_t& board, long& reg) const
 {
-	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoLaserTrig);
+	for(size_t i=0;i<segments_.size();i++){
+		const Segment& s = segments_[i];
+		if (address >= s.address && address < s.address + s.count){
+			board = s.board;
+			reg = s.reg + address - s.address;
+			return true;
+		}
+	}
+	return false;
 }
 
-
-int MojoLaserTrig::Initialize()
+bool MojoHub::SplitFrame(const std::vector<unsigned char>& frame, std::vector<std::vector<unsigned char> >& frames) const
 {
-	// Parent ID display	
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
+	// Walk the write frame and regroup its words in bursts of consecutive
+	// registers of each board
+	frames.assign(boards_.size(), std::vector<unsigned char>());
+
+	size_t board = 0;
+	long start = 0;
+	std::vector<long> run;
+
+	size_t pos = 0;
+	while (pos + 5 <= frame.size()){
+		const unsigned char header = frame[pos];
+		const long count = (header & (1 << 6)) ? (header & 0x3F) + 1 : 1;
+		const long address = frame[pos+1] | (frame[pos+2] << 8) | (frame[pos+3] << 16) | (frame[pos+4] << 24);
+		pos += 5;
+
+		for(long i=0;i<count && pos + 4 <= frame.size();i++){
+			const long value = frame[pos] | (frame[pos+1] << 8) | (frame[pos+2] << 16) | (frame[pos+3] << 24);
+			pos += 4;
+
+			size_t b;
+			long reg;
+			if (!Translate(address + i, b, reg))
+				return false;
+
+			if (!run.empty() && (b != board || reg != start + static_cast<long>(run.size()))){
+				AppendWriteFrame(frames[board], start, &run[0], static_cast<long>(run.size()));
+				run.clear();
+			}
+			if (run.empty()){
+				board = b;
+				start = reg;
+			}
+			run.push_back(value);
+		}
 	}
-	char hubLabel[MM::MaxStrLength];
-	hub->GetLabel(hubLabel);
-	SetParentID(hubLabel);
-	CreateHubIDProperty();
 
-	// Allocate memory for lasers
-	mode_ = new long [GetNumberOfLasers()];
-	duration_ = new long [GetNumberOfLasers()];
-	sequence_ = new long [GetNumberOfLasers()];
+	if (!run.empty())
+		AppendWriteFrame(frames[board], start, &run[0], static_cast<long>(run.size()));
 
-	CPropertyActionEx *pExAct;
-	int nRet;
+	return true;
+}
 
-	for(unsigned int i=0;i<GetNumberOfLasers();i++){	
-		mode_[i] = 0;
-		duration_[i] = 0;
-		sequence_[i] = 0;
+int MojoHub::WriteBoards(const MM::Device* owner, const std::vector<unsigned char>& frame, bool wait)
+{
+	std::vector<std::vector<unsigned char> > frames;
+	if (!SplitFrame(frame, frames))
+		return ERR_COMMAND_UNKNOWN;
 
-		std::stringstream mode;
-		std::stringstream dura;
-		std::stringstream seq;
-		mode << "Mode" << i;
-		dura << "Duration" << i;
-		seq << "Sequence" << i;
+	int ret = DEVICE_OK;
+	if (!wait){
+		for(size_t b=0;b<boards_.size();b++){
+			if (frames[b].empty())
+				continue;
 
-		pExAct = new CPropertyActionEx (this, &MojoLaserTrig::OnDuration,i);
-		nRet = CreateProperty(dura.str().c_str(), "0", MM::Integer, false, pExAct);
-		if (nRet != DEVICE_OK)
-			return nRet;
-		SetPropertyLimits(dura.str().c_str(), 0, 65535);   
+			int r = boards_[b]->PostFrame(owner, frames[b]);
+			if (ret == DEVICE_OK)
+				ret = r;
+		}
+		return ret;
+	}
 
-		pExAct = new CPropertyActionEx (this, &MojoLaserTrig::OnMode,i);
-		nRet = CreateProperty(mode.str().c_str(), "0", MM::Integer, false, pExAct);
-		if (nRet != DEVICE_OK)
-			return nRet;
-		SetPropertyLimits(mode.str().c_str(), 0, 4);
+	// queued on all the boards before waiting for any of them
+	std::vector<std::future<int> > done;
+	for(size_t b=0;b<boards_.size();b++){
+		if (!frames[b].empty())
+			done.push_back(boards_[b]->QueueFrame(owner, frames[b]));
+	}
+	for(size_t i=0;i<done.size();i++){
+		int r = done[i].get();
+		if (ret == DEVICE_OK)
+			ret = r;
+	}
+	return ret;
+}
 
-		pExAct = new CPropertyActionEx (this, &MojoLaserTrig::OnSequence,i);
-		nRet = CreateProperty(seq.str().c_str(), "65535", MM::Integer, false, pExAct);
-		if (nRet != DEVICE_OK)
-			return nRet;
-		SetPropertyLimits(seq.str().c_str(), 0, 65535);
+int MojoHub::ReadBoards(const MM::Device* owner, const std::vector<long>& addresses, std::vector<long>& values, bool cached)
+{
+	const size_t n = boards_.size();
+	values.assign(addresses.size(), 0);
+
+	// registers of each board, and their index in <addresses>
+	std::vector<std::vector<long> > regs(n);
+	std::vector<std::vector<size_t> > slots(n);
+	for(size_t i=0;i<addresses.size();i++){
+		size_t b;
+		long reg;
+		if (!Translate(addresses[i], b, reg))
+			return ERR_COMMAND_UNKNOWN;
+		regs[b].push_back(reg);
+		slots[b].push_back(i);
 	}
 
-	nRet = UpdateStatus();
-	if (nRet != DEVICE_OK)
-		return nRet;
+	// The registers unknown to the shadow of each board are read from all
+	// the boards concurrently
+	std::vector<std::vector<long> > known(n), missing(n), fetched(n);
+	std::vector<std::vector<size_t> > missingSlots(n);
+	std::vector<std::future<int> > done(n);
+	for(size_t b=0;b<n;b++){
+		if (regs[b].empty())
+			continue;
+
+		if (cached){
+			boards_[b]->ReadShadow(regs[b], known[b], missing[b], missingSlots[b]);
+		} else {
+			known[b].resize(regs[b].size());
+			missing[b] = regs[b];
+			for(size_t i=0;i<regs[b].size();i++){
+				missingSlots[b].push_back(i);
+			}
+		}
 
-	initialized_ = true;
+		if (!missing[b].empty()){
+			fetched[b].resize(missing[b].size());
+			done[b] = boards_[b]->PostRead(owner, missing[b], &fetched[b][0]);
+		}
+	}
 
-	return DEVICE_OK;
-}
+	int ret = DEVICE_OK;
+	for(size_t b=0;b<n;b++){
+		if (done[b].valid()){
+			int r = done[b].get();
+			if (ret == DEVICE_OK)
+				ret = r;
+			for(size_t i=0;i<missingSlots[b].size();i++){
+				known[b][missingSlots[b][i]] = fetched[b][i];
+			}
+		}
+		for(size_t i=0;i<slots[b].size();i++){
+			values[slots[b][i]] = known[b][i];
+		}
+	}
 
-int MojoLaserTrig::Shutdown()
-{
-	initialized_ = false;
-	return DEVICE_OK;
+	return ret;
 }
 
-int MojoLaserTrig::WriteToPort(long address, long value)
+int MojoHub::GetControllerVersion(long& version)
 {
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
+	// The version registers of all the supported firmware, and the registers
+	// added to a version after its first release, are read in one pass.
+	// Reading the version register of another firmware answers with an
+	// error code (or a timeout if nothing is connected).
+	std::vector<long> addresses;
+	for(int i=0;i<g_numRegisterMaps;i++){
+		addresses.push_back(g_registerMaps[i].versionAddress);
+	}
+	for(int i=0;i<g_numRegisterMaps;i++){
+		for(int o=0;o<g_numOptionalRegisters;o++){
+			if (g_registerMaps[i].*g_optionalRegisters[o] >= 0)
+				addresses.push_back(g_registerMaps[i].*g_optionalRegisters[o]);
+		}
 	}
 
-	MMThreadGuard myLock(hub->GetLock());
-
-	hub->PurgeComPortH();
-
-	int ret = hub->SendWriteRequest(address, value);
+	std::vector<long> values;
+	std::vector<bool> unknown;
+	int ret = ReadScattered(addresses, values, unknown);
 	if (ret != DEVICE_OK)
 		return ret;
 
-	return DEVICE_OK;
-}
+	long optional = g_numRegisterMaps;
+	for(int i=0;i<g_numRegisterMaps;i++){
+		const bool found = !unknown[i] && values[i] == g_registerMaps[i].version;
+		if (found){
+			registerMap_ = g_registerMaps[i];
+			map_ = &registerMap_;
+			version = values[i];
+		}
 
-int MojoLaserTrig::ReadFromPort(long& answer)
-{
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
+		for(int o=0;o<g_numOptionalRegisters;o++){
+			if (g_registerMaps[i].*g_optionalRegisters[o] < 0)
+				continue;
+			if (found && unknown[optional])
+				registerMap_.*g_optionalRegisters[o] = -1;
+			optional++;
+		}
+
+		if (found){
+			if (registerMap_.frameCount < 0)
+				registerMap_.framesRemaining = -1;
+			if (registerMap_.frameCounter < 0){
+				registerMap_.timestampLevel = -1;
+				registerMap_.timestamp = -1;
+			}
+			if (registerMap_.sampleChannels < 0){
+				registerMap_.sampleDivider = -1;
+				registerMap_.sampleLevel = -1;
+				registerMap_.sample = -1;
+			}
+			return DEVICE_OK;
+		}
 	}
-	int ret = hub->ReadAnswer(answer);
-	if (ret != DEVICE_OK)
-		return ret;
 
-	return DEVICE_OK;
+	return ERR_VERSION_MISMATCH;
 }
 
-
-///////////////////////////////////////
-/////////// Action handlers
-int MojoLaserTrig::OnNumberOfLasers(MM::PropertyBase* pProp, MM::ActionType pAct)
+int MojoHub::NegotiateProtocol()
 {
-	if (pAct == MM::BeforeGet){
-		pProp->Set(numlasers_);
-	} else if (pAct == MM::AfterSet){
-		pProp->Get(numlasers_);
+	// The protocol register is absent from the firmware released before the
+	// framed requests, its read then answers with the error code
+	framed_ = false;
+	if (protocolName_ != g_protocolFramedName)
+		return DEVICE_OK;
+
+	if (map_->protocol >= 0){
+		std::vector<long> addresses(1, map_->protocol), values;
+		std::vector<bool> unknown;
+		int ret = ReadScattered(addresses, values, unknown);
+		if (ret != DEVICE_OK)
+			return ret;
+
+		framed_ = !unknown[0] && (values[0] & g_protocolFramed) != 0;
 	}
+
+	if (!framed_)
+		LogMessage("The Mojo firmware does not support framed requests, using the legacy protocol.", false);
+
 	return DEVICE_OK;
 }
 
-int MojoLaserTrig::OnMode(MM::PropertyBase* pProp, MM::ActionType pAct, long laser)
+int MojoHub::ProbeVersion(const std::string& port, long& version)
 {
-	if (pAct == MM::BeforeGet)
-	{
-		MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-		if (!hub){
-			return ERR_NO_PORT_SET;
-		}
+	// the version registers of all the supported firmware in one request
+	std::vector<unsigned char> command;
+	for(int i=0;i<g_numRegisterMaps;i++){
+		AppendReadRequest(command, g_registerMaps[i].versionAddress, 1);
+	}
 
-		MMThreadGuard myLock(hub->GetLock());
+	const unsigned long expected = 4 * g_numRegisterMaps;
+	std::vector<unsigned char> answer(expected);
 
-		int ret = hub->SendReadRequest(g_offsetaddressLaserMode+laser);
-		if (ret != DEVICE_OK)
-			return ret;
+	for(int attempt=0;attempt<g_detectAttempts;attempt++){
+		PurgeComPort(port.c_str());
 
-		long answer;
-		ret = ReadFromPort(answer);
+		int ret = WriteToComPort(port.c_str(), &command[0], static_cast<unsigned>(command.size()));
 		if (ret != DEVICE_OK)
 			return ret;
 
-		pProp->Set(answer);
-		mode_[laser]=answer;
+		// returns as soon as the answers are in
+		MM::MMTime startTime = GetCurrentMMTime();
+		unsigned long bytesRead = 0;
+		while ((bytesRead < expected) && ((GetCurrentMMTime() - startTime).getMsec() < g_detectTimeoutMs)) {
+			unsigned long bR;
+			ret = ReadFromComPort(port.c_str(), &answer[bytesRead], expected - bytesRead, bR);
+			if (ret != DEVICE_OK)
+				return ret;
+			bytesRead += bR;
+		}
+
+		if (bytesRead < expected)
+			continue;
+
+		for(int i=0;i<g_numRegisterMaps;i++){
+			const unsigned char* word = &answer[4*i];
+			const long value = word[0] | (word[1] << 8) | (word[2] << 16) | (static_cast<long>(word[3]) << 24);
+			if (value == g_registerMaps[i].version){
+				version = value;
+				return DEVICE_OK;
+			}
+		}
+
+		return ERR_VERSION_MISMATCH;
 	}
-	else if (pAct == MM::AfterSet)
-	{
-		long mode;
-		pProp->Get(mode);
 
-		int ret = WriteToPort(g_offsetaddressLaserMode+laser,mode);  
-		if (ret != DEVICE_OK)
-			return ret;
+	return DEVICE_SERIAL_TIMEOUT;
+}
 
-		mode_[laser] = mode;
+int MojoHub::SendWriteRequest(long address, long value)
+{   
+	if (framed_)
+		return WriteBlock(address, &value, 1);
+
+	unsigned char command[9];
+	command[0] = (1 << 7);	// 1 = write
+	command[1] = static_cast<char>(address);	// put the least significant byte
+	command[2] = static_cast<char>((address >> 8));	// put the least but one significant byte 
+	command[3] = static_cast<char>((address >> 16));	
+	command[4] = static_cast<char>((address >> 24)); // address and value are 32 bits long
+	command[5] = static_cast<char>(value);	
+	command[6] = static_cast<char>((value >> 8));	
+	command[7] = static_cast<char>((value >> 16));	
+	command[8] = static_cast<char>((value >> 24));	
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	int ret;
+	{
+		MojoIOGuard guard(lock_, *ioMetrics_, ioClient_);
+		ret = WriteToComPortH((const unsigned char*) command, 9);
 	}
+	if (ret != DEVICE_OK)
+		return ret;
+
+	ioMetrics_->RecordTransaction(MojoMetrics::Write, GetRegisterRange(address), 9, 0, ElapsedUs(start));
+
+	UpdateShadow(address, &value, 1);
 
 	return DEVICE_OK;
 }
 
-int MojoLaserTrig::OnDuration(MM::PropertyBase* pProp, MM::ActionType pAct, long laser)
+void MojoHub::AppendWriteFrame(std::vector<unsigned char>& frame, long address, const long* values, long count)
 {
-	if (pAct == MM::BeforeGet)
+	// Split in bursts limited by the size of the reg_interface count field
+	long done = 0;
+	while (done < count){
+		long n = count - done;
+		if (n > g_maxBurstLength)
+			n = g_maxBurstLength;
+
+		const long start = address + done;
+		unsigned char header = (1 << 7);	// 1 = write
+		if (n > 1){
+			header |= (1 << 6) | static_cast<unsigned char>(n - 1); // auto-increment and number of words
+		}
+		frame.push_back(header);
+		frame.push_back(static_cast<unsigned char>(start));
+		frame.push_back(static_cast<unsigned char>(start >> 8));
+		frame.push_back(static_cast<unsigned char>(start >> 16));
+		frame.push_back(static_cast<unsigned char>(start >> 24));
+
+		for(long i=0;i<n;i++){
+			const long value = values[done+i];
+			frame.push_back(static_cast<unsigned char>(value));
+			frame.push_back(static_cast<unsigned char>(value >> 8));
+			frame.push_back(static_cast<unsigned char>(value >> 16));
+			frame.push_back(static_cast<unsigned char>(value >> 24));
+		}
+
+		done += n;
+	}
+}
+
+void MojoHub::AppendSequenceRestart(std::vector<unsigned char>& frame) const
+{
+	// one restart register per board
+	const std::vector<long> ones(boards_.empty() ? 1 : boards_.size(), 1);
+	AppendWriteFrame(frame, map_->sequenceRestart, &ones[0], static_cast<long>(ones.size()));
+}
+
+int MojoHub::WriteFrame(const std::vector<unsigned char>& frame, const std::vector<const MM::Device*>& owners)
+{
+	if (frame.empty())
+		return DEVICE_OK;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// only the byte exchange holds the lock, the metrics and the shadow
+	// registers are updated after
+	int ret;
+	unsigned long sent = static_cast<unsigned long>(frame.size());
 	{
-		MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-		if (!hub){
-			return ERR_NO_PORT_SET;
+		MojoIOGuard guard(lock_, *ioMetrics_, ioClient_);
+		if (framed_){
+			// answers are matched on their sequence number, no need to purge
+			std::vector<unsigned char> seqs;
+			framedBuffer_.clear();
+			AppendFramedRequests(framedBuffer_, frame, seqs, owners);
+			sent = static_cast<unsigned long>(framedBuffer_.size());
+			ret = WriteToComPortH(&framedBuffer_[0], static_cast<unsigned>(framedBuffer_.size()));
+
+			bool unknown;
+			if (ret == DEVICE_OK && inFlight_.size() > g_maxFramesInFlight)
+				ret = CollectAnswers(-1, g_maxFramesInFlight / 2, 0, unknown);
+		} else {
+			PurgeComPortH();
+			ret = WriteToComPortH(&frame[0], static_cast<unsigned>(frame.size()));
 		}
+	}
+	if (ret != DEVICE_OK)
+		return ret;
 
-		MMThreadGuard myLock(hub->GetLock());
+	// transactions are attributed to the range of their first burst
+	const long address = frame[1] | (frame[2] << 8) | (frame[3] << 16) | (frame[4] << 24);
+	ioMetrics_->RecordTransaction(MojoMetrics::Write, GetRegisterRange(address), sent, 0, ElapsedUs(start));
 
-		int ret = hub->SendReadRequest(g_offsetaddressLaserDuration+laser);
-		if (ret != DEVICE_OK)
-			return ret;
+	// the framed writes reach the shadow registers with their acknowledgement
+	if (!framed_)
+		UpdateShadow(frame);
 
-		long answer;
-		ret = ReadFromPort(answer);
-		if (ret != DEVICE_OK)
-			return ret;
+	return DEVICE_OK;
+}
+
+int MojoHub::WriteBlock(long address, const long* values, long count)
+{
+	std::vector<unsigned char> frame;
+	frame.reserve(count * 4 + (count / g_maxBurstLength + 1) * 5);
+	AppendWriteFrame(frame, address, values, count);
+
+	if (framed_)
+		ExpectWrites(frame);
+
+	return WriteFrame(frame, std::vector<const MM::Device*>(1, this));
+}
+
+int MojoHub::SendReadRequest(long address){
+	return SendBurstReadRequest(address, 1);
+}
+
+int MojoHub::SendBurstReadRequest(long address, long count){
+	// called under lock_, the request buffer keeps its capacity
+	requestBuffer_.clear();
+	AppendReadRequest(requestBuffer_, address, count);
 
-		pProp->Set(answer);
-		duration_[laser]=answer;
+	int ret = WriteToComPortH(&requestBuffer_[0], static_cast<unsigned>(requestBuffer_.size()));
+
+	return ret;
+}
+
+void MojoHub::AppendReadRequest(std::vector<unsigned char>& frame, long address, long count, bool increment)
+{
+	unsigned char header = (0 << 7);	// 0 = read
+	if (count > 1){
+		header |= static_cast<unsigned char>(count - 1); // number of words
+		if (increment)
+			header |= (1 << 6);	// auto-increment
 	}
-	else if (pAct == MM::AfterSet)
-	{
-		long pos;
-		pProp->Get(pos);
+	frame.push_back(header);
+	frame.push_back(static_cast<unsigned char>(address));
+	frame.push_back(static_cast<unsigned char>(address >> 8));
+	frame.push_back(static_cast<unsigned char>(address >> 16));
+	frame.push_back(static_cast<unsigned char>(address >> 24));
+}
+
+int MojoHub::ReadAnswer(long& ans){
+	return ReadAnswers(&ans, 1);
+}
+
+int MojoHub::ReadAnswers(long* ans, long count){
+	unsigned char answer[4 * g_maxBurstLength];
+
+	int ret = ReadBytes(answer, 4 * count);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	// Format answers
+	bool unknown = false;
+	for(long j=0;j<count;j++){
+		const unsigned char* word = answer + 4*j;
+		int tmp = word[3];
+		for(int i=1;i<4;i++){
+			tmp = tmp << 8;
+			tmp = tmp | word[3-i];
+		}
+
+		ans[j] = tmp;
+
+		// If unknown command answer
+		if(IsErrorCode(ans[j])){
+			unknown = true;
+		}
+	}
+
+	if(unknown){
+		// expected while probing the version registers
+		if (map_)
+			ioMetrics_->RecordUnknownCommand();
+		return ERR_COMMAND_UNKNOWN;
+	}
+
+	return DEVICE_OK;
+}
+
+int MojoHub::ReadBytes(unsigned char* data, unsigned long count)
+{
+	// Code adapted from Arduino.cpp, Micro-Manager, written by Nico Stuurman and Karl Hoover
+	MM::MMTime startTime = GetCurrentMMTime();  
+	unsigned long bytesRead = 0;
 
-		int ret = WriteToPort(g_offsetaddressLaserDuration+laser,pos); 
+	while ((bytesRead < count) && ( (GetCurrentMMTime() - startTime).getMsec() < 500)) {
+		// transports that can wait for the answers sleep instead of spinning
+		if (transport_ && !transport_->WaitReadable(500. - (GetCurrentMMTime() - startTime).getMsec()))
+			continue;
+
+		unsigned long bR;
+		int ret = ReadFromComPortH(data + bytesRead, count - bytesRead, bR);
 		if (ret != DEVICE_OK)
 			return ret;
+		bytesRead += bR;
 
-		duration_[laser] = pos;
+		// long bursts: restart the time out as long as data is flowing
+		if (bR > 0)
+			startTime = GetCurrentMMTime();
+	}
+
+	if (bytesRead < count){
+		ioMetrics_->RecordTimeout();
+		return DEVICE_SERIAL_TIMEOUT;
 	}
 
 	return DEVICE_OK;
 }
 
-int MojoLaserTrig::OnSequence(MM::PropertyBase* pProp, MM::ActionType pAct, long laser)
+void MojoHub::AppendFramedRequests(std::vector<unsigned char>& framed, const std::vector<unsigned char>& frame, std::vector<unsigned char>& seqs, const std::vector<const MM::Device*>& owners)
 {
-	if (pAct == MM::BeforeGet)
-	{
-		MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-		if (!hub){
-			return ERR_NO_PORT_SET;
+	// each request of the frame gets the marker and the next sequence number,
+	// the writes are kept with the owners of the frame, called under lock_
+	size_t pos = 0;
+	while (pos + 5 <= frame.size()){
+		const unsigned char header = frame[pos];
+		const bool write = (header & (1 << 7)) != 0;
+		const long count = (header & 0x3F) + 1;
+		const size_t length = write ? 5 + 4 * count : 5;
+
+		FramedRequest request;
+		request.seq = sequence_++;
+		request.write = write;
+		if (write){
+			request.request.assign(frame.begin() + pos, frame.begin() + std::min(pos + length, frame.size()));
+			request.owners = owners;
 		}
+		inFlight_.push_back(request);
+		seqs.push_back(request.seq);
 
-		MMThreadGuard myLock(hub->GetLock());
+		framed.push_back(g_frameMarker);
+		framed.push_back(request.seq);
+		framed.insert(framed.end(), frame.begin() + pos, frame.begin() + std::min(pos + length, frame.size()));
+		pos += length;
+	}
+}
 
-		int ret = hub->SendReadRequest(g_offsetaddressLaserSequence+laser);
-		if (ret != DEVICE_OK)
+int MojoHub::CollectAnswers(int seq, size_t keep, long* values, bool& unknown)
+{
+	// Reads the answers of the framed requests, under lock_, until that of
+	// request <seq> or, if <seq> is negative, until at most <keep> requests
+	// are in flight. The answers of other reads are kept for their request.
+	unknown = false;
+	for(;;){
+		if (seq >= 0){
+			std::map<unsigned char, FramedAnswer>::iterator it = early_.find(static_cast<unsigned char>(seq));
+			if (it != early_.end()){
+				std::copy(it->second.values.begin(), it->second.values.end(), values);
+				unknown = it->second.unknown;
+				early_.erase(it);
+				return DEVICE_OK;
+			}
+		} else if (inFlight_.size() <= keep){
+			return DEVICE_OK;
+		}
+
+		// sequence number and type, then the words read and the status
+		unsigned char head[2];
+		unsigned char body[4 * g_maxBurstLength + 1];
+		bool write = false;
+		long count = 0;
+		int ret = ReadBytes(head, 2);
+		if (ret == DEVICE_OK){
+			write = (head[1] & g_frameWrite) != 0;
+			count = write ? 0 : (head[1] & 0x3F) + 1;
+			ret = ReadBytes(body, 4 * count + 1);
+		}
+		if (ret != DEVICE_OK){
+			DropFramedRequests();
 			return ret;
+		}
+
+		const bool failed = (body[4 * count] & g_frameUnknown) != 0;
+		if (failed)
+			ioMetrics_->RecordUnknownCommand();
+
+		// answers of requests dropped after a time out are ignored
+		std::deque<FramedRequest>::iterator request = inFlight_.begin();
+		while (request != inFlight_.end() && request->seq != head[0]){
+			++request;
+		}
+		if (request == inFlight_.end())
+			continue;
+
+		if (write){
+			AcknowledgeWrites(*request, !failed);
+			inFlight_.erase(request);
+			continue;
+		}
+		inFlight_.erase(request);
+
+		FramedAnswer answer;
+		answer.unknown = failed;
+		for(long j=0;j<count;j++){
+			const unsigned char* word = body + 4*j;
+			answer.values.push_back(word[0] | (word[1] << 8) | (word[2] << 16) | (static_cast<long>(word[3]) << 24));
+		}
+
+		if (head[0] == seq){
+			std::copy(answer.values.begin(), answer.values.end(), values);
+			unknown = failed;
+			return DEVICE_OK;
+		}
+		early_[head[0]] = answer;
+	}
+}
+
+void MojoHub::DropFramedRequests()
+{
+	// after a time out, the board state of the writes in flight is unknown
+	for(size_t i=0;i<inFlight_.size();i++){
+		if (inFlight_[i].write){
+			AcknowledgeWrites(inFlight_[i], false);
+			for(size_t j=0;j<inFlight_[i].owners.size();j++){
+				SetError(inFlight_[i].owners[j], DEVICE_SERIAL_TIMEOUT);
+			}
+		}
+	}
+
+	inFlight_.clear();
+	early_.clear();
+	PurgeComPortH();
+}
 
-		long answer;
-		ret = ReadFromPort(answer);
+void MojoHub::CollectAcknowledgements()
+{
+	int ret;
+	{
+		MojoIOGuard guard(lock_, *ioMetrics_, MojoMetrics::ClientHub);
+		if (inFlight_.empty())
+			return;
+
+		bool unknown;
+		ret = CollectAnswers(-1, 0, 0, unknown);
+	}
+
+	// the owners of the writes lost in a time out are already told
+	if (ret != DEVICE_OK)
+		InvalidateRegisters();
+}
+
+int MojoHub::ReadBlock(long address, long count, long* values)
+{
+	if (framed_){
+		// the framed reads are pipelined by ReadScattered
+		std::vector<long> addresses(count), read;
+		std::vector<bool> unknown;
+		for(long i=0;i<count;i++){
+			addresses[i] = address + i;
+		}
+
+		int ret = ReadScattered(addresses, read, unknown);
 		if (ret != DEVICE_OK)
 			return ret;
 
-		pProp->Set(answer);
-		sequence_[laser]=answer;
+		std::copy(read.begin(), read.end(), values);
+		for(long i=0;i<count;i++){
+			if (unknown[i])
+				return ERR_COMMAND_UNKNOWN;
+		}
+		return DEVICE_OK;
 	}
-	else if (pAct == MM::AfterSet)
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	unsigned long requests = 0;
+
 	{
-		long pos;
-		pProp->Get(pos);
+		MojoIOGuard guard(lock_, *ioMetrics_, ioClient_);
 
-		int ret = WriteToPort(g_offsetaddressLaserSequence+laser,pos);
-		if (ret != DEVICE_OK)
-			return ret; 
+		// Bursts are limited by the size of the reg_interface count field
+		long done = 0;
+		while (done < count){
+			long n = count - done;
+			if (n > g_maxBurstLength)
+				n = g_maxBurstLength;
 
-		sequence_[laser] = pos;
+			int ret = SendBurstReadRequest(address + done, n);
+			if (ret != DEVICE_OK)
+				return ret;
+			requests++;
+
+			ret = ReadAnswers(values + done, n);
+			if (ret != DEVICE_OK)
+				return ret;
+
+			done += n;
+		}
 	}
 
+	ioMetrics_->RecordTransaction(MojoMetrics::Read, GetRegisterRange(address), 5 * requests, 4 * count, ElapsedUs(start));
+
 	return DEVICE_OK;
 }
 
-
-///////////////////////////////////////////////////////////////////////////////////////////
-//////
-MojoTTL::MojoTTL() :
-initialized_ (false),
-	busy_(false)
+bool MojoHub::IsErrorCode(long value) const
 {
-	InitializeDefaultErrorMessages();
+	// until the firmware is known, any of the error codes
+	if (map_)
+		return value == map_->errorCode;
 
-	// Custom error messages
-	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
-	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	for(int i=0;i<g_numRegisterMaps;i++){
+		if (value == g_registerMaps[i].errorCode)
+			return true;
+	}
+	return false;
+}
 
-	// Description
-	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo TTL", MM::String, true);
-	assert(DEVICE_OK == ret);
+MojoMetrics::Range MojoHub::GetRegisterRange(long address) const
+{
+	if (map_ == 0)
+		return MojoMetrics::Version;
+
+	if (address < map_->ttl)
+		return MojoMetrics::Laser;
+	if (address < map_->servo)
+		return MojoMetrics::TTL;
+	if (address < map_->pwm)
+		return MojoMetrics::Servo;
+	if (address < map_->pwm + map_->maxPWM)
+		return MojoMetrics::PWM;
+	if (address >= map_->activeTrigger && address <= map_->laserDelay)
+		return MojoMetrics::Camera;
+	if (address >= map_->analogInput && address < map_->analogInput + map_->maxAnalogInput)
+		return MojoMetrics::Analog;
+	if (address == map_->versionAddress || address == map_->idAddress)
+		return MojoMetrics::Version;
+	return MojoMetrics::Other;
+}
 
-	// Name
-	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoTTL, MM::String, true);
-	assert(DEVICE_OK == ret);
+double MojoHub::ElapsedUs(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
 
-	// Number of TTL channels
-	CPropertyAction* pAct = new CPropertyAction(this, &MojoTTL::OnNumberOfChannels);
-	CreateProperty("Number of channels", "4", MM::Integer, false, pAct, true);
-	SetPropertyLimits("Number of channels", 1, g_maxttl);
+MojoMetrics::Client MojoHub::GetClient(const MM::Device* owner)
+{
+	char name[MM::MaxStrLength];
+	owner->GetName(name);
+
+	if (strcmp(name, g_DeviceNameMojoLaserTrig) == 0)
+		return MojoMetrics::ClientLaserTrig;
+	if (strcmp(name, g_DeviceNameMojoLaserShutter) == 0)
+		return MojoMetrics::ClientLaserShutter;
+	if (strcmp(name, g_DeviceNameMojoTTL) == 0)
+		return MojoMetrics::ClientTTL;
+	if (strcmp(name, g_DeviceNameMojoPWM) == 0)
+		return MojoMetrics::ClientPWM;
+	if (strcmp(name, g_DeviceNameMojoServos) == 0)
+		return MojoMetrics::ClientServos;
+	if (strcmp(name, g_DeviceNameMojoInput) == 0)
+		return MojoMetrics::ClientInput;
+	if (strcmp(name, g_DeviceNameMojoCameraTrigger) == 0)
+		return MojoMetrics::ClientCameraTrigger;
+	return MojoMetrics::ClientHub;
 }
 
-MojoTTL::~MojoTTL()
+bool MojoHub::IsVolatileRegister(long address) const
 {
-	Shutdown();
+	// the analog inputs, the frames remaining, the frame timestamps and the
+	// sample queue are changed by the board itself, as well as the start of
+	// the camera trigger when it runs bursts, the sequence restart reads 0
+	// whatever was written, nothing is cached until the register map is known
+	if (map_ == 0)
+		return true;
+	if (map_->frameCount >= 0 && (address == map_->startTrigger || address == map_->framesRemaining))
+		return true;
+	if (map_->frameCounter >= 0 && address >= map_->frameCounter && address <= map_->timestamp)
+		return true;
+	if (map_->sampleChannels >= 0 && (address == map_->sampleLevel || address == map_->sample))
+		return true;
+	if (map_->sequenceRestart >= 0 && address == map_->sequenceRestart)
+		return true;
+	return address >= map_->analogInput && address < map_->analogInput + map_->maxAnalogInput;
 }
 
-void MojoTTL::GetName(char* name) const
+void MojoHub::UpdateShadow(long address, const long* values, long count)
 {
-	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoTTL);
+	MMThreadGuard myLock(shadowLock_);
+
+	for(long i=0;i<count;i++){
+		const long reg = address + i;
+		if (reg >= 0 && reg < g_maxRegisters && !IsVolatileRegister(reg) && shadowPending_[reg] == 0){
+			shadow_[reg] = values[i];
+			shadowValid_[reg] = true;
+		}
+	}
 }
 
+void MojoHub::UpdateShadow(const std::vector<unsigned char>& frame)
+{
+	// Walk the write frame and report each burst to the shadow registers
+	size_t pos = 0;
+	while (pos + 5 <= frame.size()){
+		const unsigned char header = frame[pos];
+		const long count = (header & (1 << 6)) ? (header & 0x3F) + 1 : 1;
+		const long address = frame[pos+1] | (frame[pos+2] << 8) | (frame[pos+3] << 16) | (frame[pos+4] << 24);
+		pos += 5;
+
+		for(long i=0;i<count && pos + 4 <= frame.size();i++){
+			const long value = frame[pos] | (frame[pos+1] << 8) | (frame[pos+2] << 16) | (frame[pos+3] << 24);
+			UpdateShadow(address + i, &value, 1);
+			pos += 4;
+		}
+	}
+}
 
-int MojoTTL::Initialize()
+void MojoHub::ExpectWrites(const std::vector<unsigned char>& frame)
 {
-	// Parent ID display	
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
+	// The registers of a framed write are read from the board until it is
+	// acknowledged, the shadow registers only hold acknowledged values
+	MMThreadGuard myLock(shadowLock_);
+
+	size_t pos = 0;
+	while (pos + 5 <= frame.size()){
+		const unsigned char header = frame[pos];
+		const long count = (header & 0x3F) + 1;
+		const long step = (header & (1 << 6)) ? 1 : 0;
+		const long address = frame[pos+1] | (frame[pos+2] << 8) | (frame[pos+3] << 16) | (frame[pos+4] << 24);
+		pos += 5 + 4 * count;
+
+		for(long i=0;i<count;i++){
+			const long reg = address + step * i;
+			if (reg >= 0 && reg < g_maxRegisters){
+				shadowValid_[reg] = false;
+				shadowPending_[reg]++;
+			}
+		}
 	}
-	char hubLabel[MM::MaxStrLength];
-	hub->GetLabel(hubLabel);
-	SetParentID(hubLabel);
-	CreateHubIDProperty();
+}
 
-	// State
-	// -----
+void MojoHub::AcknowledgeWrites(const FramedRequest& request, bool ok)
+{
+	// A refused write leaves its registers unknown and is reported to the
+	// owners of its frame. The value of an acknowledged write is kept unless
+	// a later write to the same register is pending.
+	if (!ok){
+		for(size_t i=0;i<request.owners.size();i++){
+			SetError(request.owners[i], ERR_COMMAND_UNKNOWN);
+		}
+	}
 
-	// Allocate memory for TTLs
-	state_ = new long [GetNumberOfChannels()];
+	const std::vector<unsigned char>& frame = request.request;
+	if (frame.size() < 5)
+		return;
+
+	const unsigned char header = frame[0];
+	const long count = (header & 0x3F) + 1;
+	const long step = (header & (1 << 6)) ? 1 : 0;
+	const long address = frame[1] | (frame[2] << 8) | (frame[3] << 16) | (frame[4] << 24);
+
+	MMThreadGuard myLock(shadowLock_);
+
+	for(long i=0;i<count && 5 + 4 * static_cast<size_t>(i) + 4 <= frame.size();i++){
+		const long reg = address + step * i;
+		if (reg < 0 || reg >= g_maxRegisters)
+			continue;
+
+		if (shadowPending_[reg] > 0)
+			shadowPending_[reg]--;
+
+		const unsigned char* word = &frame[5 + 4 * i];
+		if (ok && shadowPending_[reg] == 0 && !IsVolatileRegister(reg)){
+			shadow_[reg] = word[0] | (word[1] << 8) | (word[2] << 16) | (static_cast<long>(word[3]) << 24);
+			shadowValid_[reg] = true;
+		} else if (!ok){
+			shadowValid_[reg] = false;
+		}
+	}
+}
+
+void MojoHub::InvalidateRegisters()
+{
+	for(size_t b=0;b<boards_.size();b++){
+		boards_[b]->InvalidateRegisters();
+	}
+
+	MMThreadGuard myLock(shadowLock_);
+	shadowValid_.assign(g_maxRegisters, false);
+}
+
+int MojoHub::ReadRegisters(long address, long count, long* values)
+{
+	if (!boards_.empty()){
+		std::vector<long> addresses(count), read;
+		for(long i=0;i<count;i++){
+			addresses[i] = address + i;
+		}
+
+		int ret = ReadBoards(this, addresses, read, true);
+		std::copy(read.begin(), read.end(), values);
+		return ret;
+	}
+
+	// serve the registers from memory if they are all known
+	{
+		MMThreadGuard myLock(shadowLock_);
+
+		bool cached = true;
+		for(long i=0;i<count && cached;i++){
+			const long reg = address + i;
+			cached = reg >= 0 && reg < g_maxRegisters && shadowValid_[reg];
+		}
+
+		if (cached){
+			for(long i=0;i<count;i++){
+				values[i] = shadow_[address + i];
+			}
+			return DEVICE_OK;
+		}
+	}
+
+	// otherwise read them from the board, after the commands already queued
+	return SendRead(this, address, count, values);
+}
+
+int MojoHub::ReadScattered(const std::vector<long>& addresses, std::vector<long>& values, std::vector<bool>& unknown)
+{
+	const long count = static_cast<long>(addresses.size());
+	values.assign(count, 0);
+	unknown.assign(count, false);
+	if (count == 0)
+		return DEVICE_OK;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	unsigned long requests = 0;
+
+	{
+		// the request buffer is reused under the lock
+		MojoIOGuard guard(lock_, *ioMetrics_, ioClient_);
+
+		long done = 0;
+		while (done < count){
+			// The read requests of a window of registers are sent back-to-back,
+			// consecutive addresses are merged into bursts, and repeated ones
+			// (reads of a queue) into bursts without auto-increment
+			std::vector<unsigned char>& command = requestBuffer_;
+			command.clear();
+			std::vector<long> bursts;
+			long window = 0;
+			while (done + window < count && window < g_maxPipelinedWords){
+				const long first = addresses[done + window];
+				const long step = done + window + 1 < count && addresses[done + window + 1] == first ? 0 : 1;
+				long n = 1;
+				while (done + window + n < count && window + n < g_maxPipelinedWords && n < g_maxBurstLength
+					&& addresses[done + window + n] == first + step * n){
+					n++;
+				}
+
+				AppendReadRequest(command, first, n, step != 0);
+				bursts.push_back(n);
+				window += n;
+			}
+
+			std::vector<unsigned char> seqs;
+			int ret;
+			if (framed_){
+				framedBuffer_.clear();
+				AppendFramedRequests(framedBuffer_, command, seqs, std::vector<const MM::Device*>());
+				ret = WriteToComPortH(&framedBuffer_[0], static_cast<unsigned>(framedBuffer_.size()));
+			} else {
+				ret = WriteToComPortH(&command[0], static_cast<unsigned>(command.size()));
+			}
+			if (ret != DEVICE_OK)
+				return ret;
+			requests += static_cast<unsigned long>(bursts.size());
+
+			// then the answers are collected, an unknown address only flags
+			// its own registers (its burst with framed requests)
+			long pos = done;
+			for(size_t i=0;i<bursts.size();i++){
+				if (framed_){
+					bool failed;
+					ret = CollectAnswers(seqs[i], 0, &values[pos], failed);
+					if (ret != DEVICE_OK)
+						return ret;
+					std::fill(unknown.begin() + pos, unknown.begin() + pos + bursts[i], failed);
+				} else {
+					ret = ReadAnswers(&values[pos], bursts[i]);
+					if (ret != DEVICE_OK && ret != ERR_COMMAND_UNKNOWN)
+						return ret;
+				}
+				pos += bursts[i];
+			}
+
+			done += window;
+		}
+	}
+
+	// the legacy answers flag unknown registers with the error code
+	for(long i=0;i<count && !framed_;i++){
+		unknown[i] = IsErrorCode(values[i]);
+	}
+
+	// framed requests: marker and sequence number, answered with 3 more bytes
+	const unsigned long framing = framed_ ? 2 : 0;
+	ioMetrics_->RecordTransaction(MojoMetrics::Read, GetRegisterRange(addresses[0]), (5 + framing) * requests,
+		4 * count + (framed_ ? 3 : 0) * requests, ElapsedUs(start));
+
+	return DEVICE_OK;
+}
+
+int MojoHub::ReadQueue(long address, long count, long* values)
+{
+	// The register is read <count> times, in bursts without auto-increment.
+	// A word of the queue can match the error code of the legacy answers, an
+	// unknown register is only reported by framed requests.
+	if (count <= 0)
+		return DEVICE_OK;
+
+	std::vector<long> addresses(count, address), read;
+	int ret = ReadRegisters(addresses, read);
+	std::copy(read.begin(), read.end(), values);
+
+	const bool framed = boards_.empty() ? framed_ : boards_[0]->framed_;
+	if (ret == ERR_COMMAND_UNKNOWN && !framed)
+		return DEVICE_OK;
+	return ret;
+}
+
+int MojoHub::ReadRegisters(const std::vector<long>& addresses, std::vector<long>& values)
+{
+	if (!boards_.empty())
+		return ReadBoards(this, addresses, values, true);
+
+	// registers known from memory, the others are read in a single pipelined pass
+	std::vector<long> missing;
+	std::vector<size_t> slots;
+	ReadShadow(addresses, values, missing, slots);
+
+	if (missing.empty())
+		return DEVICE_OK;
+
+	// after the commands already queued
+	std::vector<long> fetched(missing.size());
+	int ret = PostRead(this, missing, &fetched[0]).get();
+	for(size_t i=0;i<slots.size();i++){
+		values[slots[i]] = fetched[i];
+	}
+
+	return ret;
+}
+
+void MojoHub::ReadShadow(const std::vector<long>& addresses, std::vector<long>& values, std::vector<long>& missing, std::vector<size_t>& slots)
+{
+	// values of the registers known from memory, the others are listed in
+	// <missing> with their index in <slots>
+	values.resize(addresses.size());
+
+	MMThreadGuard myLock(shadowLock_);
+
+	for(size_t i=0;i<addresses.size();i++){
+		const long reg = addresses[i];
+		if (reg >= 0 && reg < g_maxRegisters && shadowValid_[reg]){
+			values[i] = shadow_[reg];
+		} else {
+			missing.push_back(reg);
+			slots.push_back(i);
+		}
+	}
+}
+
+int MojoHub::ResyncRegisters()
+{
+	if (!boards_.empty()){
+		// the boards are read back concurrently
+		std::vector<std::vector<long> > values(boards_.size());
+		std::vector<std::future<int> > done;
+		for(size_t b=0;b<boards_.size();b++){
+			const MojoRegisterMap& map = *boards_[b]->map_;
+			values[b].resize(map.analogInput - map.laserMode);
+
+			boards_[b]->InvalidateRegisters();
+			done.push_back(boards_[b]->PostRead(boards_[b], map.laserMode, static_cast<long>(values[b].size()), &values[b][0]));
+		}
+
+		int ret = DEVICE_OK;
+		for(size_t b=0;b<done.size();b++){
+			int r = done[b].get();
+			if (ret == DEVICE_OK)
+				ret = r;
+		}
+		return ret;
+	}
+
+	// All host-written registers, from the laser modes to the analog inputs,
+	// are read back in one burst. The unused registers in between are read
+	// and cached as well.
+	const long first = map_->laserMode;
+	const long count = map_->analogInput - first;
+	std::vector<long> values(count);
+
+	InvalidateRegisters();
+
+	return ReadRegisters(first, count, &values[0]);
+}
+
+///////////////////////////////////////
+/////////// Presets
+void MojoHub::GetPresetRegisters(std::vector<long>& addresses) const
+{
+	addresses.clear();
+	for(long i=0;i<map_->maxLasers;i++){
+		addresses.push_back(map_->laserMode + i);
+	}
+	for(long i=0;i<map_->maxLasers;i++){
+		addresses.push_back(map_->laserDuration + i);
+	}
+	for(long i=0;i<map_->maxLasers;i++){
+		addresses.push_back(map_->laserSequence + i);
+	}
+	for(long i=0;i<map_->maxTTL;i++){
+		addresses.push_back(map_->ttl + i);
+	}
+	for(long i=0;i<map_->maxServos;i++){
+		addresses.push_back(map_->servo + i);
+	}
+	for(long i=0;i<map_->maxPWM;i++){
+		addresses.push_back(map_->pwm + i);
+	}
+}
+
+int MojoHub::StorePreset(const std::string& name)
+{
+	// the image is taken from the shadow registers, and from the board
+	// for the registers not known yet
+	std::vector<long> addresses, values;
+	GetPresetRegisters(addresses);
+
+	int ret = ReadRegisters(addresses, values);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	presets_[name] = values;
+	return DEVICE_OK;
+}
+
+int MojoHub::ApplyPreset(const std::string& name)
+{
+	std::map<std::string, std::vector<long> >::const_iterator it = presets_.find(name);
+	if (it == presets_.end())
+		return ERR_PRESET_UNKNOWN;
+	const std::vector<long>& image = it->second;
+
+	std::vector<long> addresses, current;
+	GetPresetRegisters(addresses);
+
+	int ret = ReadRegisters(addresses, current);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	// the lasers held by a closed laser shutter stay OFF
+	std::vector<long> target(image);
+	for(size_t i=0;i<addresses.size();i++){
+		const long laser = addresses[i] - map_->laserMode;
+		if (laser >= 0 && laser < map_->maxLasers && UpdateHeldLaser(laser, target[i]))
+			target[i] = 0;
+	}
+
+	// Changed registers are grouped in runs of consecutive addresses, which
+	// may include a few unchanged registers written with their own value
+	std::vector<unsigned char> frame;
+	size_t i = 0;
+	while (i < addresses.size()){
+		if (target[i] == current[i]){
+			i++;
+			continue;
+		}
+
+		size_t end = i + 1;		// one past the last changed register of the run
+		size_t next = end;
+		while (next < addresses.size() && addresses[next] == addresses[next-1] + 1
+			&& static_cast<long>(next - end) <= g_presetMaxGap){
+			if (target[next] != current[next])
+				end = next + 1;
+			next++;
+		}
+
+		AppendWriteFrame(frame, addresses[i], &target[i], static_cast<long>(end - i));
+		i = end;
+	}
+
+	if (frame.empty())
+		return DEVICE_OK;
+
+	// in one transfer, returns once it is on the wire
+	return SendFrame(this, frame);
+}
+
+int MojoHub::DeletePreset(const std::string& name)
+{
+	if (presets_.erase(name) == 0)
+		return ERR_PRESET_UNKNOWN;
+	return DEVICE_OK;
+}
+
+void MojoHub::HoldLaser(long laser, long mode)
+{
+	std::lock_guard<std::mutex> guard(heldMutex_);
+	heldLasers_[laser] = mode;
+}
+
+void MojoHub::ReleaseLaser(long laser)
+{
+	std::lock_guard<std::mutex> guard(heldMutex_);
+	heldLasers_.erase(laser);
+}
+
+bool MojoHub::GetHeldLaser(long laser, long& mode)
+{
+	std::lock_guard<std::mutex> guard(heldMutex_);
+	std::map<long, long>::const_iterator it = heldLasers_.find(laser);
+	if (it == heldLasers_.end())
+		return false;
+
+	mode = it->second;
+	return true;
+}
+
+bool MojoHub::UpdateHeldLaser(long laser, long mode)
+{
+	// the new mode of a held laser waits for the shutter to open
+	std::lock_guard<std::mutex> guard(heldMutex_);
+	std::map<long, long>::iterator it = heldLasers_.find(laser);
+	if (it == heldLasers_.end())
+		return false;
+
+	it->second = mode;
+	return true;
+}
+
+int MojoHub::SavePresets(const std::string& path) const
+{
+	// A header with the firmware version and the register addresses, then
+	// one preset per line: its values followed by its name
+	std::ofstream file(path.c_str());
+	if (!file)
+		return ERR_PRESET_FILE;
+
+	std::vector<long> addresses;
+	GetPresetRegisters(addresses);
+
+	file << g_presetFileHeader << " " << version_ << " " << addresses.size() << "\n";
+	for(size_t i=0;i<addresses.size();i++){
+		file << (i == 0 ? "" : " ") << addresses[i];
+	}
+	file << "\n";
+
+	std::map<std::string, std::vector<long> >::const_iterator it;
+	for(it=presets_.begin();it!=presets_.end();++it){
+		for(size_t i=0;i<it->second.size();i++){
+			file << it->second[i] << " ";
+		}
+		file << it->first << "\n";
+	}
+
+	return file ? DEVICE_OK : ERR_PRESET_FILE;
+}
+
+int MojoHub::LoadPresets(const std::string& path)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+		return ERR_PRESET_FILE;
+
+	std::vector<long> addresses;
+	GetPresetRegisters(addresses);
+
+	// the file must have been written for the same register map
+	std::string header;
+	long version;
+	size_t count;
+	if (!(file >> header >> version >> count) || header != g_presetFileHeader
+		|| version != version_ || count != addresses.size())
+		return ERR_PRESET_FILE;
+
+	for(size_t i=0;i<count;i++){
+		long address;
+		if (!(file >> address) || address != addresses[i])
+			return ERR_PRESET_FILE;
+	}
+
+	std::map<std::string, std::vector<long> > presets;
+	std::string line;
+	std::getline(file, line);
+	while (std::getline(file, line)){
+		if (line.empty())
+			continue;
+
+		std::istringstream is(line);
+		std::vector<long> values(count);
+		for(size_t i=0;i<count;i++){
+			if (!(is >> values[i]))
+				return ERR_PRESET_FILE;
+		}
+
+		std::string name;
+		is >> std::ws;
+		std::getline(is, name);
+		if (name.empty())
+			return ERR_PRESET_FILE;
+
+		presets[name] = values;
+	}
+
+	presets_.swap(presets);
+	return DEVICE_OK;
+}
+
+///////////////////////////////////////
+/////////// I/O thread
+int MojoHub::PostWrite(const MM::Device* owner, long address, long value)
+{
+	MojoTransaction* t = new MojoTransaction(owner);
+	t->posted = true;
+	AppendWriteFrame(t->frame, address, &value, 1);
+
+	return PostFrame(t);
+}
+
+int MojoHub::PostFrame(const MM::Device* owner, const std::vector<unsigned char>& frame)
+{
+	MojoTransaction* t = new MojoTransaction(owner);
+	t->posted = true;
+	t->frame = frame;
+
+	return PostFrame(t);
+}
+
+int MojoHub::PostFrame(MojoTransaction* t)
+{
+	const MM::Device* owner = t->owners[0];
+	if (!boards_.empty()){
+		int ret = WriteBoards(t->owners[0], t->frame, false);
+		delete t;
+		return ret;
+	}
+
+	// Write-through now, so that reads served before the frame is sent are
+	// consistent (read from the board until acknowledged with framed requests)
+	if (framed_)
+		ExpectWrites(t->frame);
+	else
+		UpdateShadow(t->frame);
+
+	{
+		std::lock_guard<std::mutex> guard(queueMutex_);
+		if (batchDepth_ > 0){
+			// held in the batch buffer until CommitBatch
+			const MojoMetrics::Client client = GetClient(t->owners[0]);
+			batchClient_ = batchOwners_.empty() || batchClient_ == client ? client : MojoMetrics::ClientHub;
+			batchFrame_.insert(batchFrame_.end(), t->frame.begin(), t->frame.end());
+			batchOwners_.push_back(t->owners[0]);
+			delete t;
+			t = 0;
+		}
+	}
+
+	if (t != 0)
+		Enqueue(t);
+
+	// report errors of the previous asynchronous writes of the owner
+	return TakeError(owner);
+}
+
+void MojoHub::SetError(const MM::Device* owner, int error)
+{
+	// the first error is kept until the owner collects it
+	std::lock_guard<std::mutex> guard(queueMutex_);
+	if (ioErrors_.find(owner) == ioErrors_.end())
+		ioErrors_[owner] = error;
+}
+
+int MojoHub::TakeError(const MM::Device* owner)
+{
+	std::lock_guard<std::mutex> guard(queueMutex_);
+	std::map<const MM::Device*, int>::iterator it = ioErrors_.find(owner);
+	if (it == ioErrors_.end())
+		return DEVICE_OK;
+
+	const int ret = it->second;
+	ioErrors_.erase(it);
+	return ret;
+}
+
+void MojoHub::BeginBatch()
+{
+	for(size_t b=0;b<boards_.size();b++){
+		boards_[b]->BeginBatch();
+	}
+
+	std::lock_guard<std::mutex> guard(queueMutex_);
+	batchDepth_++;
+}
+
+int MojoHub::CommitBatch()
+{
+	// each board queues its part of the batch on its own I/O thread
+	int ret = DEVICE_OK;
+	for(size_t b=0;b<boards_.size();b++){
+		int r = boards_[b]->CommitBatch();
+		if (ret == DEVICE_OK)
+			ret = r;
+	}
+	if (!boards_.empty()){
+		std::lock_guard<std::mutex> guard(queueMutex_);
+		if (batchDepth_ > 0)
+			batchDepth_--;
+		return ret;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(queueMutex_);
+		if (batchDepth_ == 0 || --batchDepth_ > 0)
+			return DEVICE_OK;
+	}
+
+	// queues the batch alone
+	Enqueue(0);
+
+	// report errors of the previous asynchronous writes of the hub
+	return TakeError(this);
+}
+
+int MojoHub::SendFrame(const MM::Device* owner, const std::vector<unsigned char>& frame)
+{
+	if (!boards_.empty())
+		return WriteBoards(owner, frame, true);
+
+	// sent after the writes already queued, returns once it is on the wire,
+	// or with the error of a previous asynchronous write of the owner
+	int ret = QueueFrame(owner, frame).get();
+	int previous = TakeError(owner);
+	return previous != DEVICE_OK ? previous : ret;
+}
+
+std::future<int> MojoHub::QueueFrame(const MM::Device* owner, const std::vector<unsigned char>& frame)
+{
+	MojoTransaction* t = new MojoTransaction(owner);
+	t->frame = frame;
+	if (framed_)
+		ExpectWrites(t->frame);
+	else
+		UpdateShadow(t->frame);
+
+	std::future<int> done = t->done.get_future();
+	Enqueue(t);
+
+	return done;
+}
+
+int MojoHub::SendRead(const MM::Device* owner, long address, long count, long* values)
+{
+	if (!boards_.empty())
+		return PostRead(owner, address, count, values).get();
+
+	// The transaction comes from a pool and the caller waits on a condition
+	// variable instead of a future: once the pool holds a transaction per
+	// concurrent reader, a read makes no allocation
+	MojoTransaction* t;
+	{
+		std::lock_guard<std::mutex> guard(queueMutex_);
+		if (readPool_.empty()){
+			t = new MojoTransaction(owner);
+			t->pooled = true;
+		} else {
+			t = readPool_.back();
+			readPool_.pop_back();
+			t->owners[0] = owner;
+		}
+	}
+	t->address = address;
+	t->count = count;
+	t->values = values;
+	t->finished = false;
+
+	Enqueue(t);
+
+	std::unique_lock<std::mutex> guard(queueMutex_);
+	while (!t->finished)
+		readCond_.wait(guard);
+
+	readPool_.push_back(t);
+	return t->result;
+}
+
+std::future<int> MojoHub::PostRead(const MM::Device* owner, long address, long count, long* values)
+{
+	if (!boards_.empty()){
+		// the boards are read concurrently, the read is over on return
+		std::vector<long> addresses(count), read;
+		for(long i=0;i<count;i++){
+			addresses[i] = address + i;
+		}
+
+		std::promise<int> done;
+		done.set_value(ReadBoards(owner, addresses, read, false));
+		std::copy(read.begin(), read.end(), values);
+		return done.get_future();
+	}
+
+	MojoTransaction* t = new MojoTransaction(owner);
+	t->address = address;
+	t->count = count;
+	t->values = values;
+
+	std::future<int> done = t->done.get_future();
+	Enqueue(t);
+
+	return done;
+}
+
+std::future<int> MojoHub::PostRead(const MM::Device* owner, const std::vector<long>& addresses, long* values)
+{
+	MojoTransaction* t = new MojoTransaction(owner);
+	t->addresses = addresses;
+	t->values = values;
+
+	std::future<int> done = t->done.get_future();
+	Enqueue(t);
+
+	return done;
+}
+
+bool MojoHub::IsBusy(const MM::Device* owner)
+{
+	for(size_t b=0;b<boards_.size();b++){
+		if (boards_[b]->IsBusy(owner))
+			return true;
+	}
+
+	// the writes held in an open batch are not sent yet
+	std::lock_guard<std::mutex> guard(queueMutex_);
+	std::map<const MM::Device*, int>::const_iterator it = pendingCommands_.find(owner);
+	return (it != pendingCommands_.end() && it->second > 0)
+		|| std::find(batchOwners_.begin(), batchOwners_.end(), owner) != batchOwners_.end();
+}
+
+void MojoHub::Enqueue(MojoTransaction* t)
+{
+	// the owner may be gone by the time the transaction is executed
+	if (t != 0)
+		t->client = GetClient(t->owners[0]);
+
+	MojoTransaction* batch;
+	{
+		std::lock_guard<std::mutex> guard(queueMutex_);
+
+		// The frames held in a batch go first, so that the board sees the
+		// commands in order. A read or a synchronous write within a batch
+		// therefore sends the batch early.
+		batch = TakeBatch();
+
+		if (ioRunning_){
+			if (batch != 0)
+				Push(batch);
+			if (t != 0)
+				Push(t);
+			queueCond_.notify_one();
+			return;
+		}
+	}
+
+	// no I/O thread (initialization, detection): run in the calling thread
+	if (batch != 0){
+		Execute(batch);
+		Finish(batch);
+	}
+	if (t != 0){
+		Execute(t);
+		Finish(t);
+	}
+}
+
+void MojoHub::Push(MojoTransaction* t)
+{
+	// called with queueMutex_ held
+	queue_.push_back(t);
+	for(size_t i=0;i<t->owners.size();i++){
+		pendingCommands_[t->owners[i]]++;
+	}
+}
+
+MojoTransaction* MojoHub::TakeBatch()
+{
+	// called with queueMutex_ held, the batch buffer keeps its capacity
+	if (batchFrame_.empty())
+		return 0;
+
+	MojoTransaction* t = new MojoTransaction(batchOwners_[0]);
+	t->owners = batchOwners_;
+	t->client = batchClient_;
+	t->posted = true;
+	t->frame.assign(batchFrame_.begin(), batchFrame_.end());
+
+	batchFrame_.clear();
+	batchOwners_.clear();
+
+	return t;
+}
+
+void MojoHub::Execute(MojoTransaction* t)
+{
+	// the lock metrics of the transaction go to the type of its owners
+	ioClient_ = t->client;
+
+	int ret;
+	if (!t->frame.empty()){
+		ret = WriteFrame(t->frame, t->owners);
+		if (ret != DEVICE_OK){
+			// the shadow registers were updated when the frame was queued
+			InvalidateRegisters();
+
+			// reported by the next call of each owner
+			for(size_t i=0;i<t->owners.size() && t->posted;i++){
+				SetError(t->owners[i], ret);
+			}
+		}
+	} else if (!t->addresses.empty()){
+		std::vector<long> values;
+		std::vector<bool> unknown;
+		ret = ReadScattered(t->addresses, values, unknown);
+		for(size_t i=0;i<values.size() && ret == DEVICE_OK;i++){
+			t->values[i] = values[i];
+		}
+		for(size_t i=0;i<unknown.size() && ret == DEVICE_OK;i++){
+			if (unknown[i])
+				ret = ERR_COMMAND_UNKNOWN;
+		}
+		for(size_t i=0;i<values.size();i++){
+			if (!unknown[i])
+				UpdateShadow(t->addresses[i], &values[i], 1);
+		}
+	} else {
+		ret = ReadBlock(t->address, t->count, t->values);
+		if (ret == DEVICE_OK)
+			UpdateShadow(t->address, t->values, t->count);
+	}
+
+	ioClient_ = MojoMetrics::ClientHub;
+	t->result = ret;
+	if (!t->pooled)
+		t->done.set_value(ret);
+}
+
+void MojoHub::Finish(MojoTransaction* t)
+{
+	// a pooled transaction goes back to the thread waiting for it
+	if (!t->pooled){
+		delete t;
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(queueMutex_);
+	t->finished = true;
+	readCond_.notify_all();
+}
+
+void MojoHub::StartIOThread()
+{
+	std::lock_guard<std::mutex> guard(queueMutex_);
+	if (ioRunning_)
+		return;
+
+	stopIO_ = false;
+	ioRunning_ = true;
+	ioThread_ = std::thread(&MojoHub::IOThread, this);
+}
+
+void MojoHub::StopIOThread()
+{
+	{
+		std::lock_guard<std::mutex> guard(queueMutex_);
+		if (!ioRunning_)
+			return;
+		stopIO_ = true;
+		queueCond_.notify_one();
+	}
+
+	// the thread sends the remaining commands before exiting
+	ioThread_.join();
+
+	std::lock_guard<std::mutex> guard(queueMutex_);
+	ioRunning_ = false;
+}
+
+void MojoHub::IOThread()
+{
+	for(;;){
+		// the board acknowledges the framed writes while the thread is idle
+		bool idle;
+		{
+			std::lock_guard<std::mutex> guard(queueMutex_);
+			idle = queue_.empty();
+		}
+		if (idle && framed_)
+			CollectAcknowledgements();
+
+		MojoTransaction* t;
+		{
+			std::unique_lock<std::mutex> guard(queueMutex_);
+			while (queue_.empty() && !stopIO_)
+				queueCond_.wait(guard);
+
+			if (queue_.empty())
+				return;
+
+			t = queue_.front();
+			queue_.pop_front();
+		}
+
+		Execute(t);
+
+		{
+			std::lock_guard<std::mutex> guard(queueMutex_);
+			for(size_t i=0;i<t->owners.size();i++){
+				// the entries are kept, a transaction of a known owner makes no allocation
+				std::map<const MM::Device*, int>::iterator it = pendingCommands_.find(t->owners[i]);
+				if (it != pendingCommands_.end() && it->second > 0)
+					it->second--;
+			}
+		}
+
+		Finish(t);
+	}
+}
+
+int MojoHub::OnPort(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(port_.c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(port_);
+		portAvailable_ = true;
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnTransport(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(transportName_.c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(transportName_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnTtyDevice(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(ttyDevice_.c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(ttyDevice_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnBridgeHost(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(bridgeHost_.c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(bridgeHost_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnBridgePort(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(bridgePort_);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(bridgePort_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnSimulatorLatency(MM::PropertyBase* pProp, MM::ActionType pAct, long index)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(simulatorLatencyUs_[index]);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(simulatorLatencyUs_[index]);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnBoardID(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(boardID_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnVersion(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set((long)version_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnMetricsCounter(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		const std::string name = pProp->GetName();
+		unsigned long long value = 0;
+		if (name == g_metricsCounters[0])
+			value = metrics_.GetTransactions(MojoMetrics::Read);
+		else if (name == g_metricsCounters[1])
+			value = metrics_.GetTransactions(MojoMetrics::Write);
+		else if (name == g_metricsCounters[2])
+			value = metrics_.GetBytesSent();
+		else if (name == g_metricsCounters[3])
+			value = metrics_.GetBytesReceived();
+		else if (name == g_metricsCounters[4])
+			value = metrics_.GetTimeouts();
+		else if (name == g_metricsCounters[5])
+			value = metrics_.GetUnknownCommands();
+
+		pProp->Set(static_cast<long>(value));
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnMetricsLatency(MM::PropertyBase* pProp, MM::ActionType pAct, long index)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		MojoMetrics::Operation op = static_cast<MojoMetrics::Operation>(index / MojoMetrics::NumRanges);
+		MojoMetrics::Range range = static_cast<MojoMetrics::Range>(index % MojoMetrics::NumRanges);
+		pProp->Set(metrics_.FormatLatency(op, range).c_str());
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnMetricsLock(MM::PropertyBase* pProp, MM::ActionType pAct, long index)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		MojoMetrics::LockTime time = static_cast<MojoMetrics::LockTime>(index / MojoMetrics::NumClients);
+		MojoMetrics::Client client = static_cast<MojoMetrics::Client>(index % MojoMetrics::NumClients);
+		pProp->Set(metrics_.FormatLockTime(time, client).c_str());
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnMetricsFile(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(metricsFile_.c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(metricsFile_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnMetricsAction(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set("Idle");
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		std::string action;
+		pProp->Get(action);
+		pProp->Set("Idle");
+		if (action == "Dump"){
+			return metrics_.Dump(metricsFile_);
+		} else if (action == "Reset"){
+			metrics_.Reset();
+		}
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnBatchWrites(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(batchProperty_ ? 1L : 0L);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		long batch;
+		pProp->Get(batch);
+
+		if (batch != 0 && !batchProperty_){
+			batchProperty_ = true;
+			BeginBatch();
+		} else if (batch == 0 && batchProperty_){
+			batchProperty_ = false;
+			return CommitBatch();
+		}
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnNumberOfBoards(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(numBoards_);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(numBoards_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnBoardTransport(MM::PropertyBase* pProp, MM::ActionType pAct, long board)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(boardTransport_[board].c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(boardTransport_[board]);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnBoardPort(MM::PropertyBase* pProp, MM::ActionType pAct, long board)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(boardPort_[board].c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(boardPort_[board]);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnProtocol(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(protocolName_.c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(protocolName_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnPresetName(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(presetName_.c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(presetName_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnPreset(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set("Idle");
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		std::string action;
+		pProp->Get(action);
+		pProp->Set("Idle");
+		if (action == "Store"){
+			return StorePreset(presetName_);
+		} else if (action == "Apply"){
+			return ApplyPreset(presetName_);
+		} else if (action == "Delete"){
+			return DeletePreset(presetName_);
+		}
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnPresetFile(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(presetFile_.c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(presetFile_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnPresetFileAction(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set("Idle");
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		std::string action;
+		pProp->Get(action);
+		pProp->Set("Idle");
+		if (action == "Save"){
+			return SavePresets(presetFile_);
+		} else if (action == "Load"){
+			return LoadPresets(presetFile_);
+		}
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnStartupPreset(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(startupPreset_.c_str());
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(startupPreset_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnPresets(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		// names of the stored presets
+		std::string names;
+		std::map<std::string, std::vector<long> >::const_iterator it;
+		for(it=presets_.begin();it!=presets_.end();++it){
+			names += (names.empty() ? "" : ", ") + it->first;
+		}
+		pProp->Set(names.c_str());
+	}
+	return DEVICE_OK;
+}
+
+int MojoHub::OnResync(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set("Idle");
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		std::string resync;
+		pProp->Get(resync);
+		if (resync == "Resync"){
+			pProp->Set("Idle");
+			return ResyncRegisters();
+		}
+	}
+	return DEVICE_OK;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//////
+MojoLaserTrig::MojoLaserTrig() :
+initialized_ (false),
+	deferred_(false),
+	pending_(false)
+{
+	InitializeDefaultErrorMessages();
+
+	// Custom error messages
+	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
+	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	SetErrorText(ERR_CHANNELS_UNAVAILABLE, "The firmware on the Mojo does not provide that many channels.");
+	SetErrorText(ERR_SEQUENCE_INVALID, "The property sequence cannot be loaded on the Mojo.");
+
+	// Description
+	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo laser triggering system", MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Name
+	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoLaserTrig, MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Number of lasers
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoLaserTrig::OnNumberOfLasers);
+	CreateProperty("Number of lasers", "4", MM::Integer, false, pAct, true);
+	SetPropertyLimits("Number of lasers", 1, g_maxlasers);
+}
+
+
+MojoLaserTrig::~MojoLaserTrig()
+{
+	Shutdown();
+}
+
+void MojoLaserTrig::GetName(char* name) const
+{
+	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoLaserTrig);
+}
+
+bool MojoLaserTrig::Busy()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	return hub != 0 && hub->IsBusy(this);
+}
+
+
+int MojoLaserTrig::Initialize()
+{
+	// Parent ID display	
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	char hubLabel[MM::MaxStrLength];
+	hub->GetLabel(hubLabel);
+	SetParentID(hubLabel);
+	CreateHubIDProperty();
+
+	const MojoRegisterMap& map = hub->GetRegisterMap();
+	if (GetNumberOfLasers() > (unsigned long) map.maxLasers)
+		return ERR_CHANNELS_UNAVAILABLE;
+	modeAddress_ = map.laserMode;
+	durationAddress_ = map.laserDuration;
+	sequenceAddress_ = map.laserSequence;
+	restartAddress_ = map.sequenceRestart;
+
+	// Allocate memory for lasers
+	mode_ = new long [GetNumberOfLasers()];
+	duration_ = new long [GetNumberOfLasers()];
+	sequence_ = new long [GetNumberOfLasers()];
+	sequenceMode_.assign(GetNumberOfLasers(), 0);
+	sequencePattern_.assign(GetNumberOfLasers(), 0);
+	savedMode_.assign(GetNumberOfLasers(), 0);
+	savedSequence_.assign(GetNumberOfLasers(), 0);
+
+	CPropertyActionEx *pExAct;
+	int nRet;
+
+	for(unsigned int i=0;i<GetNumberOfLasers();i++){	
+		mode_[i] = 0;
+		duration_[i] = 0;
+		sequence_[i] = 0;
+
+		std::stringstream mode;
+		std::stringstream dura;
+		std::stringstream seq;
+		mode << "Mode" << i;
+		dura << "Duration" << i;
+		seq << "Sequence" << i;
+
+		pExAct = new CPropertyActionEx (this, &MojoLaserTrig::OnDuration,i);
+		nRet = CreateProperty(dura.str().c_str(), "0", MM::Integer, false, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits(dura.str().c_str(), 0, map.maxDuration);   
+
+		pExAct = new CPropertyActionEx (this, &MojoLaserTrig::OnMode,i);
+		nRet = CreateProperty(mode.str().c_str(), "0", MM::Integer, false, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits(mode.str().c_str(), 0, 4);
+
+		pExAct = new CPropertyActionEx (this, &MojoLaserTrig::OnSequence,i);
+		nRet = CreateProperty(seq.str().c_str(), "65535", MM::Integer, false, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits(seq.str().c_str(), 0, 65535);
+	}
+
+	// Deferred writes: modes, durations and sequences are kept on the host
+	// and sent to the board in a single transfer when "Apply all" is set
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoLaserTrig::OnDeferredWrites);
+	nRet = CreateProperty("Deferred writes", "0", MM::Integer, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	AddAllowedValue("Deferred writes", "0");
+	AddAllowedValue("Deferred writes", "1");
+
+	pAct = new CPropertyAction(this, &MojoLaserTrig::OnApplyAll);
+	nRet = CreateProperty("Apply all", "Idle", MM::String, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	AddAllowedValue("Apply all", "Idle");
+	AddAllowedValue("Apply all", "Apply");
+
+	nRet = UpdateStatus();
+	if (nRet != DEVICE_OK)
+		return nRet;
+
+	initialized_ = true;
+
+	return DEVICE_OK;
+}
+
+int MojoLaserTrig::Shutdown()
+{
+	initialized_ = false;
+	return DEVICE_OK;
+}
+
+int MojoLaserTrig::WriteToPort(long address, long value)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// queued on the hub I/O thread, Busy() reports until it is sent
+	return hub->PostWrite(this, address, value);
+}
+
+int MojoLaserTrig::ApplyAll()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	std::vector<long> modes(GetNumberOfLasers());
+	for(unsigned long i=0;i<GetNumberOfLasers();i++){
+		modes[i] = GateMode(i, mode_[i]);
+	}
+
+	// Modes, durations and sequences are sent as three bursts in one transfer
+	std::vector<unsigned char> frame;
+	MojoHub::AppendWriteFrame(frame, modeAddress_, &modes[0], GetNumberOfLasers());
+	MojoHub::AppendWriteFrame(frame, durationAddress_, duration_, GetNumberOfLasers());
+	MojoHub::AppendWriteFrame(frame, sequenceAddress_, sequence_, GetNumberOfLasers());
+
+	int ret = hub->PostFrame(this, frame);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	pending_ = false;
+
+	return DEVICE_OK;
+}
+
+int MojoLaserTrig::RefreshFromPort()
+{
+	// do not overwrite values that have not been applied yet
+	if (pending_)
+		return DEVICE_OK;
+
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// Modes, durations and sequences come from the hub shadow registers, or
+	// from one pipelined read of the three blocks if they are not known yet
+	const long n = GetNumberOfLasers();
+	std::vector<long> addresses(3*n);
+	for(long i=0;i<n;i++){
+		addresses[i] = modeAddress_+i;
+		addresses[n+i] = durationAddress_+i;
+		addresses[2*n+i] = sequenceAddress_+i;
+	}
+
+	std::vector<long> values;
+	int ret = hub->ReadRegisters(addresses, values);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	for(long i=0;i<n;i++){
+		mode_[i] = values[i];
+		duration_[i] = values[n+i];
+		sequence_[i] = values[2*n+i];
+
+		// a laser held by a closed laser shutter shows the mode it opens to
+		hub->GetHeldLaser(i, mode_[i]);
+	}
+
+	return DEVICE_OK;
+}
+
+int MojoLaserTrig::WriteModeAndSequence(long laser, long mode, long sequence, bool restart)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// mode and sequence change in the same transfer, the laser never runs
+	// the new mode with the old sequence
+	const long gated = GateMode(laser, mode);
+	std::vector<unsigned char> frame;
+	MojoHub::AppendWriteFrame(frame, modeAddress_+laser, &gated, 1);
+	MojoHub::AppendWriteFrame(frame, sequenceAddress_+laser, &sequence, 1);
+	if (restart)
+		hub->AppendSequenceRestart(frame);
+
+	return hub->SendFrame(this, frame);
+}
+
+long MojoLaserTrig::GateMode(long laser, long mode)
+{
+	// a laser held by a closed laser shutter stays OFF, the shutter applies
+	// the mode when it opens
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (hub != 0 && hub->UpdateHeldLaser(laser, mode))
+		return 0;
+	return mode;
+}
+
+// Compiles a sequence of laser modes into a single mode and a 16-bit
+// sequence: the firmware gates the triggered modes with bit (15-n) of the
+// sequence on the n-th camera frame, the sequence length must divide 16.
+// Frames can switch between OFF and one triggered mode (or be all ON).
+static int CompileModeSequence(const std::vector<std::string>& sequence, long& mode, long& pattern)
+{
+	const long n = (long) sequence.size();
+	if (n == 0 || 16 % n != 0)
+		return ERR_SEQUENCE_INVALID;
+
+	long triggered = 0;
+	bool on = false;
+	bool off = false;
+	pattern = 0;
+	for(long k=0;k<16;k++){
+		const long m = atol(sequence[k % n].c_str());
+		if (m == 0){
+			off = true;
+			continue;
+		}
+
+		if (m == 1){
+			on = true;
+		} else {
+			if (triggered != 0 && triggered != m)
+				return ERR_SEQUENCE_INVALID;
+			triggered = m;
+		}
+		pattern |= (1L << (15-k));
+	}
+
+	if (on && (off || triggered != 0))
+		return ERR_SEQUENCE_INVALID;
+
+	if (on){
+		mode = 1;
+	} else {
+		mode = triggered;	// 0 if all frames are OFF
+	}
+
+	return DEVICE_OK;
+}
+
+
+///////////////////////////////////////
+/////////// Action handlers
+int MojoLaserTrig::OnNumberOfLasers(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(numlasers_);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(numlasers_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoLaserTrig::OnDeferredWrites(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(deferred_ ? 1L : 0L);
+	} else if (pAct == MM::AfterSet){
+		long deferred;
+		pProp->Get(deferred);
+		deferred_ = deferred != 0;
+	}
+	return DEVICE_OK;
+}
+
+int MojoLaserTrig::OnApplyAll(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set("Idle");
+	} else if (pAct == MM::AfterSet){
+		std::string apply;
+		pProp->Get(apply);
+		if (apply == "Apply"){
+			pProp->Set("Idle");
+			return ApplyAll();
+		}
+	}
+	return DEVICE_OK;
+}
+
+int MojoLaserTrig::OnMode(MM::PropertyBase* pProp, MM::ActionType pAct, long laser)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(mode_[laser]);
+	}
+	else if (pAct == MM::IsSequenceable)
+	{
+		// one mode per frame, cycled by the firmware over the 16 bits of
+		// Sequence<laser>, only if the firmware can restart the cycle
+		if (restartAddress_ >= 0)
+			pProp->SetSequenceable(16);
+		else
+			pProp->SetSequenceable(0);
+	}
+	else if (pAct == MM::AfterLoadSequence)
+	{
+		return CompileModeSequence(pProp->GetSequence(), sequenceMode_[laser], sequencePattern_[laser]);
+	}
+	else if (pAct == MM::StartSequence)
+	{
+		// The pattern and the sequence restart are written together: the
+		// next camera frame plays the first step of the sequence.
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		savedMode_[laser] = mode_[laser];
+		savedSequence_[laser] = sequence_[laser];
+
+		return WriteModeAndSequence(laser, sequenceMode_[laser], sequencePattern_[laser], true);
+	}
+	else if (pAct == MM::StopSequence)
+	{
+		return WriteModeAndSequence(laser, savedMode_[laser], savedSequence_[laser], false);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		long mode;
+		pProp->Get(mode);
+
+		if (deferred_){
+			pending_ = true;
+		} else {
+			int ret = WriteToPort(modeAddress_+laser, GateMode(laser, mode));
+			if (ret != DEVICE_OK)
+				return ret;
+		}
+
+		mode_[laser] = mode;
+	}
+
+	return DEVICE_OK;
+}
+
+int MojoLaserTrig::OnDuration(MM::PropertyBase* pProp, MM::ActionType pAct, long laser)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(duration_[laser]);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		long pos;
+		pProp->Get(pos);
+
+		if (deferred_){
+			pending_ = true;
+		} else {
+			int ret = WriteToPort(durationAddress_+laser,pos);
+			if (ret != DEVICE_OK)
+				return ret;
+		}
+
+		duration_[laser] = pos;
+	}
+
+	return DEVICE_OK;
+}
+
+int MojoLaserTrig::OnSequence(MM::PropertyBase* pProp, MM::ActionType pAct, long laser)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(sequence_[laser]);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		long pos;
+		pProp->Get(pos);
+
+		if (deferred_){
+			pending_ = true;
+		} else {
+			int ret = WriteToPort(sequenceAddress_+laser,pos);
+			if (ret != DEVICE_OK)
+				return ret;
+		}
+
+		sequence_[laser] = pos;
+	}
+
+	return DEVICE_OK;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//////
+MojoLaserShutter::MojoLaserShutter() :
+initialized_ (false),
+	openDark_(false)
+{
+	InitializeDefaultErrorMessages();
+
+	// Custom error messages
+	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
+	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	SetErrorText(ERR_CHANNELS_UNAVAILABLE, "The firmware on the Mojo does not provide that many channels.");
+
+	// Description
+	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo laser shutter", MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Name
+	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoLaserShutter, MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Number of lasers
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoLaserShutter::OnNumberOfLasers);
+	CreateProperty("Number of lasers", "4", MM::Integer, false, pAct, true);
+	SetPropertyLimits("Number of lasers", 1, g_maxlasers);
+}
+
+MojoLaserShutter::~MojoLaserShutter()
+{
+	Shutdown();
+}
+
+void MojoLaserShutter::GetName(char* name) const
+{
+	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoLaserShutter);
+}
+
+bool MojoLaserShutter::Busy()
+{
+	// true until the transfer of the last SetOpen is on the wire
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	return hub != 0 && hub->IsBusy(this);
+}
+
+int MojoLaserShutter::Initialize()
+{
+	// Parent ID display	
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	char hubLabel[MM::MaxStrLength];
+	hub->GetLabel(hubLabel);
+	SetParentID(hubLabel);
+	CreateHubIDProperty();
+
+	const MojoRegisterMap& map = hub->GetRegisterMap();
+	if (GetNumberOfLasers() > (unsigned long) map.maxLasers)
+		return ERR_CHANNELS_UNAVAILABLE;
+	modeAddress_ = map.laserMode;
+
+	// lasers that are already on open with their current mode
+	int nRet = ReadModes(openMode_);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	selected_.assign(GetNumberOfLasers(), 1);
+
+	// Lasers switched by the shutter
+	for(unsigned int i=0;i<GetNumberOfLasers();i++){
+		std::stringstream laser;
+		laser << "Laser" << i;
+
+		CPropertyActionEx* pExAct = new CPropertyActionEx(this, &MojoLaserShutter::OnSelected, i);
+		nRet = CreateProperty(laser.str().c_str(), "1", MM::Integer, false, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		AddAllowedValue(laser.str().c_str(), "0");
+		AddAllowedValue(laser.str().c_str(), "1");
+
+		// mode of the laser when the shutter opens, 0 if it has none (all
+		// the lasers are OFF after a reset of the board)
+		std::stringstream openMode;
+		openMode << "OpenMode" << i;
+
+		pExAct = new CPropertyActionEx(this, &MojoLaserShutter::OnOpenMode, i);
+		nRet = CreateProperty(openMode.str().c_str(), CDeviceUtils::ConvertToString(openMode_[i]), MM::Integer, false, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits(openMode.str().c_str(), 0, 4);
+	}
+
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoLaserShutter::OnState);
+	nRet = CreateProperty(MM::g_Keyword_State, "0", MM::Integer, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	AddAllowedValue(MM::g_Keyword_State, "0");
+	AddAllowedValue(MM::g_Keyword_State, "1");
+
+	nRet = UpdateStatus();
+	if (nRet != DEVICE_OK)
+		return nRet;
+
+	initialized_ = true;
+
+	return DEVICE_OK;
+}
+
+int MojoLaserShutter::Shutdown()
+{
+	// the laser trigger drives the lasers again
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (initialized_ && hub){
+		for(unsigned long i=0;i<GetNumberOfLasers();i++){
+			hub->ReleaseLaser(i);
+		}
+	}
+
+	initialized_ = false;
+	return DEVICE_OK;
+}
+
+int MojoLaserShutter::ReadModes(std::vector<long>& modes)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// from the hub shadow registers, or from a single burst if they are not known yet
+	modes.resize(GetNumberOfLasers());
+	return hub->ReadRegisters(modeAddress_, GetNumberOfLasers(), &modes[0]);
+}
+
+int MojoLaserShutter::SetOpen(bool open)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	std::vector<long> modes;
+	int ret = ReadModes(modes);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	// The modes written by the laser trigger while the shutter was closed
+	// are the open modes. Opening with no selected laser to switch on, as
+	// with all the lasers OFF for a dark frame, lights nothing, like a real
+	// shutter with no light behind it.
+	if (open){
+		bool any = false;
+		for(unsigned long i=0;i<GetNumberOfLasers();i++){
+			if (!selected_[i])
+				continue;
+
+			hub->GetHeldLaser(i, openMode_[i]);
+			if (modes[i] != 0 || openMode_[i] != 0)
+				any = true;
+		}
+		if (!any)
+			LogMessage("Laser shutter opened with no laser to switch on, see the OpenMode properties.", true);
+		openDark_ = !any;
+	} else {
+		openDark_ = false;
+	}
+
+	// new modes of the selected lasers, and the range of lasers that change
+	long first = -1;
+	long last = -1;
+	for(long i=0;i<(long) GetNumberOfLasers();i++){
+		if (!selected_[i])
+			continue;
+
+		long mode = modes[i];
+		if (open){
+			if (mode == 0)
+				mode = openMode_[i];
+		} else {
+			if (mode != 0)
+				openMode_[i] = mode;
+			mode = 0;
+		}
+
+		if (mode != modes[i]){
+			modes[i] = mode;
+			if (first < 0)
+				first = i;
+			last = i;
+		}
+	}
+
+	// the laser trigger cannot switch the lasers on while the shutter is closed
+	for(unsigned long i=0;i<GetNumberOfLasers() && !open;i++){
+		if (selected_[i])
+			hub->HoldLaser(i, openMode_[i]);
+	}
+
+	// One burst covers the lasers that change, the lasers in between that are
+	// not switched by the shutter are rewritten with their current mode.
+	if (first >= 0){
+		std::vector<unsigned char> frame;
+		MojoHub::AppendWriteFrame(frame, modeAddress_+first, &modes[first], last-first+1);
+
+		ret = hub->PostFrame(this, frame);
+	}
+
+	for(unsigned long i=0;i<GetNumberOfLasers() && open;i++){
+		if (selected_[i])
+			hub->ReleaseLaser(i);
+	}
+
+	return ret;
+}
+
+int MojoLaserShutter::GetOpen(bool& open)
+{
+	std::vector<long> modes;
+	int ret = ReadModes(modes);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	// open as soon as one of the selected lasers is not OFF, or if it was
+	// opened with all of them OFF
+	open = openDark_;
+	for(unsigned int i=0;i<GetNumberOfLasers();i++){
+		if (selected_[i] && modes[i] != 0)
+			open = true;
+	}
+
+	return DEVICE_OK;
+}
+
+int MojoLaserShutter::Fire(double /*deltaT*/)
+{
+	return DEVICE_UNSUPPORTED_COMMAND;
+}
+
+///////////////////////////////////////
+/////////// Action handlers
+int MojoLaserShutter::OnNumberOfLasers(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(numlasers_);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(numlasers_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoLaserShutter::OnSelected(MM::PropertyBase* pProp, MM::ActionType pAct, long laser)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(selected_[laser]);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(selected_[laser]);
+
+		// a laser removed from a closed shutter stays OFF
+		MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+		if (!selected_[laser] && hub)
+			hub->ReleaseLaser(laser);
+	}
+	return DEVICE_OK;
+}
+
+int MojoLaserShutter::OnOpenMode(MM::PropertyBase* pProp, MM::ActionType pAct, long laser)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	if (pAct == MM::BeforeGet){
+		hub->GetHeldLaser(laser, openMode_[laser]);
+		pProp->Set(openMode_[laser]);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(openMode_[laser]);
+		hub->UpdateHeldLaser(laser, openMode_[laser]);
+	}
+	return DEVICE_OK;
+}
+
+int MojoLaserShutter::OnState(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		bool open;
+		int ret = GetOpen(open);
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(open ? 1L : 0L);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		long state;
+		pProp->Get(state);
+
+		return SetOpen(state != 0);
+	}
+	return DEVICE_OK;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//////
+MojoTTL::MojoTTL() :
+initialized_ (false)
+{
+	InitializeDefaultErrorMessages();
+
+	// Custom error messages
+	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
+	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	SetErrorText(ERR_CHANNELS_UNAVAILABLE, "The firmware on the Mojo does not provide that many channels.");
+	SetErrorText(ERR_SEQUENCE_INVALID, "The property sequence cannot be loaded on the Mojo.");
+
+	// Description
+	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo TTL", MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Name
+	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoTTL, MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Number of TTL channels
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoTTL::OnNumberOfChannels);
+	CreateProperty("Number of channels", "4", MM::Integer, false, pAct, true);
+	SetPropertyLimits("Number of channels", 1, g_maxttl);
+}
+
+MojoTTL::~MojoTTL()
+{
+	Shutdown();
+}
+
+void MojoTTL::GetName(char* name) const
+{
+	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoTTL);
+}
+
+bool MojoTTL::Busy()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	return hub != 0 && hub->IsBusy(this);
+}
+
+
+int MojoTTL::Initialize()
+{
+	// Parent ID display	
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	char hubLabel[MM::MaxStrLength];
+	hub->GetLabel(hubLabel);
+	SetParentID(hubLabel);
+	CreateHubIDProperty();
+
+	const MojoRegisterMap& map = hub->GetRegisterMap();
+	if (GetNumberOfChannels() > (unsigned long) map.maxTTL)
+		return ERR_CHANNELS_UNAVAILABLE;
+	address_ = map.ttl;
+	sequenceAddress_ = map.ttlSequence;
+	restartAddress_ = map.sequenceRestart;
+	pattern_.assign(GetNumberOfChannels(), 0);
+
+	// State
+	// -----
+
+	// Allocate memory for TTLs
+	state_ = new long [GetNumberOfChannels()];
+
+	CPropertyActionEx *pExAct;
+	int nRet;
+
+	for(unsigned int i=0;i<GetNumberOfChannels();i++){
+		state_[i]  = 0;
+
+		std::stringstream sstm;
+		sstm << "State" << i;
+
+		pExAct = new CPropertyActionEx (this, &MojoTTL::OnState,i);
+		nRet = CreateProperty(sstm.str().c_str(), "0", MM::Integer, false, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		AddAllowedValue(sstm.str().c_str(), "0");
+		AddAllowedValue(sstm.str().c_str(), "1");
+	}
+
+	nRet = UpdateStatus();
+	if (nRet != DEVICE_OK)
+		return nRet;
+
+	initialized_ = true;
+
+	return DEVICE_OK;
+}
+
+int MojoTTL::Shutdown()
+{
+	initialized_ = false;
+	return DEVICE_OK;
+}
+
+int MojoTTL::WriteToPort(long address, long state)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	int val = 0;
+	if(state == 1){
+		val = 1;
+	} 
+
+	// queued on the hub I/O thread, Busy() reports until it is sent
+	return hub->PostWrite(this, address, val);
+}
+
+int MojoTTL::RefreshFromPort()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// TTL states come from the hub shadow registers, or
+	// from a single burst if they are not known yet
+	int ret = hub->ReadRegisters(address_, GetNumberOfChannels(), state_);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	return DEVICE_OK;
+}
+
+int MojoTTL::WritePattern(long channel, bool enable)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// bit 16 switches the output from State<channel> to the pattern
+	long value = pattern_[channel];
+	if (enable)
+		value |= (1L << 16);
+
+	// the pattern starts on its first step at the next camera frame
+	std::vector<unsigned char> frame;
+	MojoHub::AppendWriteFrame(frame, sequenceAddress_+channel, &value, 1);
+	if (enable)
+		hub->AppendSequenceRestart(frame);
+
+	return hub->SendFrame(this, frame);
+}
+
+///////////////////////////////////////
+/////////// Action handlers
+int MojoTTL::OnNumberOfChannels(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(numChannels_);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(numChannels_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoTTL::OnState(MM::PropertyBase* pProp, MM::ActionType pAct, long channel)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(state_[channel]);
+	}
+	else if (pAct == MM::IsSequenceable)
+	{
+		// only firmware with TTL pattern registers and the sequence restart
+		// can sequence the states
+		if (sequenceAddress_ >= 0 && restartAddress_ >= 0)
+			pProp->SetSequenceable(16);
+		else
+			pProp->SetSequenceable(0);
+	}
+	else if (pAct == MM::AfterLoadSequence)
+	{
+		// bit (15-n) holds the state of the n-th camera frame,
+		// the sequence length must divide 16
+		std::vector<std::string> sequence = pProp->GetSequence();
+		const long n = (long) sequence.size();
+		if (sequenceAddress_ < 0 || n == 0 || 16 % n != 0)
+			return ERR_SEQUENCE_INVALID;
+
+		pattern_[channel] = 0;
+		for(long k=0;k<16;k++){
+			if (atol(sequence[k % n].c_str()) != 0)
+				pattern_[channel] |= (1L << (15-k));
+		}
+	}
+	else if (pAct == MM::StartSequence)
+	{
+		// restarted with the pattern, as the lasers
+		return WritePattern(channel, true);
+	}
+	else if (pAct == MM::StopSequence)
+	{
+		return WritePattern(channel, false);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		long pos;
+		pProp->Get(pos);
+
+		int ret = WriteToPort(address_+channel, pos); 
+		if (ret != DEVICE_OK)
+			return ret;
+
+		state_[channel] = pos;
+	}
+
+	return DEVICE_OK;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//////
+MojoServo::MojoServo() :
+initialized_ (false)
+{
+	InitializeDefaultErrorMessages();
+
+	// Custom error messages
+	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
+	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	SetErrorText(ERR_CHANNELS_UNAVAILABLE, "The firmware on the Mojo does not provide that many channels.");
+
+	// Description
+	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo Servo controller", MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Name
+	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoServos, MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Number of servos
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoServo::OnNumberOfServos);
+	CreateProperty("Number of Servos", "4", MM::Integer, false, pAct, true);
+	SetPropertyLimits("Number of Servos", 1, g_maxservos);
+}
+
+MojoServo::~MojoServo()
+{
+	Shutdown();
+}
+
+void MojoServo::GetName(char* name) const
+{
+	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoServos);
+}
+
+bool MojoServo::Busy()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	return hub != 0 && hub->IsBusy(this);
+}
+
+
+int MojoServo::Initialize()
+{
+	// Parent ID display	
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	char hubLabel[MM::MaxStrLength];
+	hub->GetLabel(hubLabel);
+	SetParentID(hubLabel);
+	CreateHubIDProperty();
+
+	const MojoRegisterMap& map = hub->GetRegisterMap();
+	if (GetNumberOfServos() > (unsigned long) map.maxServos)
+		return ERR_CHANNELS_UNAVAILABLE;
+	address_ = map.servo;
+
+	// State
+	// -----
+
+	// Allocate memory for servos
+	position_ = new long [GetNumberOfServos()];
+
+	CPropertyActionEx *pExAct;
+	int nRet;
+
+	for(unsigned int i=0;i<GetNumberOfServos();i++){	
+		position_[i] = 0;
+
+		std::stringstream sstm;
+		sstm << "Position" << i;
+
+		pExAct = new CPropertyActionEx (this, &MojoServo::OnPosition,i);
+		nRet = CreateProperty(sstm.str().c_str(), "0", MM::Integer, false, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits(sstm.str().c_str(), 0, 65535);
+	}
+
+	nRet = UpdateStatus();
+	if (nRet != DEVICE_OK)
+		return nRet;
+
+	initialized_ = true;
+
+	return DEVICE_OK;
+}
+
+int MojoServo::Shutdown()
+{
+	initialized_ = false;
+	return DEVICE_OK;
+}
+
+int MojoServo::WriteToPort(long address, long value)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// queued on the hub I/O thread, Busy() reports until it is sent
+	return hub->PostWrite(this, address, value);
+}
+
+int MojoServo::RefreshFromPort()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// Servo positions come from the hub shadow registers, or
+	// from a single burst if they are not known yet
+	int ret = hub->ReadRegisters(address_, GetNumberOfServos(), position_);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	return DEVICE_OK;
+}
+
+
+///////////////////////////////////////
+/////////// Action handlers
+int MojoServo::OnNumberOfServos(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(numServos_);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(numServos_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoServo::OnPosition(MM::PropertyBase* pProp, MM::ActionType pAct, long servo)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(position_[servo]);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		long pos;
+		pProp->Get(pos);
+
+		int ret = WriteToPort(address_+servo,pos); 
+		if (ret != DEVICE_OK)
+			return ret;
+
+		position_[servo] = pos;
+	}
+
+	return DEVICE_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//////
+MojoPWM::MojoPWM() :
+initialized_ (false)
+{
+	InitializeDefaultErrorMessages();
+
+	// Custom error messages
+	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
+	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	SetErrorText(ERR_CHANNELS_UNAVAILABLE, "The firmware on the Mojo does not provide that many channels.");
+
+	// Description
+	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo PWM controller", MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Name
+	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoPWM, MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Number of PWM channels
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoPWM::OnNumberOfChannels);
+	CreateProperty("Number of PWM", "1", MM::Integer, false, pAct, true);
+	SetPropertyLimits("Number of PWM", 1, g_maxpwm);
+}
+
+MojoPWM::~MojoPWM()
+{
+	Shutdown();
+}
+
+void MojoPWM::GetName(char* name) const
+{
+	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoPWM);
+}
+
+bool MojoPWM::Busy()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	return hub != 0 && hub->IsBusy(this);
+}
+
+
+int MojoPWM::Initialize()
+{
+	// Parent ID display	
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	char hubLabel[MM::MaxStrLength];
+	hub->GetLabel(hubLabel);
+	SetParentID(hubLabel);
+	CreateHubIDProperty();
+
+	const MojoRegisterMap& map = hub->GetRegisterMap();
+	if (GetNumberOfChannels() > (unsigned long) map.maxPWM)
+		return ERR_CHANNELS_UNAVAILABLE;
+	address_ = map.pwm;
+
+	// State
+	// -----
+
+	// Allocate memory for channels
+	state_ = new long [GetNumberOfChannels()];
 
 	CPropertyActionEx *pExAct;
 	int nRet;
 
-	for(unsigned int i=0;i<GetNumberOfChannels();i++){
-		state_[i]  = 0;
+	for(unsigned int i=0;i<GetNumberOfChannels();i++){
+		state_[i] = 0;
+
+		std::stringstream sstm;
+		sstm << "Position" << i;
+
+		pExAct = new CPropertyActionEx (this, &MojoPWM::OnState,i);
+		nRet = CreateProperty(sstm.str().c_str(), "0", MM::Integer, false, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits(sstm.str().c_str(), 0, 255);
+	}
+
+	nRet = UpdateStatus();
+	if (nRet != DEVICE_OK)
+		return nRet;
+
+	initialized_ = true;
+
+	return DEVICE_OK;
+}
+
+int MojoPWM::Shutdown()
+{
+	initialized_ = false;
+	return DEVICE_OK;
+}
+
+int MojoPWM::WriteToPort(long address, long position)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// queued on the hub I/O thread, Busy() reports until it is sent
+	return hub->PostWrite(this, address, position);
+}
+
+int MojoPWM::RefreshFromPort()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// PWM duty cycles come from the hub shadow registers, or
+	// from a single burst if they are not known yet
+	int ret = hub->ReadRegisters(address_, GetNumberOfChannels(), state_);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	return DEVICE_OK;
+}
+
+///////////////////////////////////////
+/////////// Action handlers
+int MojoPWM::OnNumberOfChannels(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(numChannels_);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(numChannels_);
+	}
+	return DEVICE_OK;
+}
+
+int MojoPWM::OnState(MM::PropertyBase* pProp, MM::ActionType pAct, long channel)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(state_[channel]);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		long pos;
+		pProp->Get(pos);
+
+		if(pos<0 || pos>255){
+			pos = 0;
+		}
+
+		int ret = WriteToPort(address_+channel,pos); 
+		if (ret != DEVICE_OK)
+			return ret;
+
+		state_[channel] = pos;
+	}
+
+	return DEVICE_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//////
+MojoCameraTrigger::MojoCameraTrigger() :
+initialized_ (false),
+	frameCountAddress_(-1),
+	framesRemainingAddress_(-1),
+	burstFrames_(0),
+	burst_(false),
+	frameCounterAddress_(-1),
+	timestampLevelAddress_(-1),
+	timestampAddress_(-1),
+	lastTimestamp_(0),
+	singleIntervals_(0),
+	intervalSum_(0.),
+	intervalSquares_(0.)
+{
+	for(int i=0;i<NumRegisters;i++){
+		address_[i] = -1;
+		state_[i] = 0;
+	}
+
+	timing_.frames = 0;
+	timing_.timestamps = 0;
+	timing_.lostTimestamps = 0;
+	timing_.missedFrames = 0;
+	timing_.periodUs = 0.;
+	timing_.meanIntervalUs = 0.;
+	timing_.jitterUs = 0.;
+	timing_.maxJitterUs = 0.;
+
+	plannerInput_[PlanFrameRateInput] = 20.;
+	plannerInput_[PlanExposureInput] = 10000.;
+	plannerInput_[PlanReadoutInput] = 0.;
+	plannerInput_[PlanDelayInput] = 0.;
+	PlanFrameRate(20., 10000., 0., 0., plan_);
+
+	InitializeDefaultErrorMessages();
+
+	// Custom error messages
+	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
+	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	SetErrorText(ERR_NO_CAMERA_TRIGGER, "The firmware on the Mojo has no camera trigger. Please use firmware version 3.");
+	SetErrorText(ERR_FRAME_PLAN, "The exposure, readout or laser delay of the frame-rate planner exceed the camera trigger registers.");
+	SetErrorText(ERR_FRAME_RATE_RANGE, "The frame rate of the frame-rate planner cannot be reached with its exposure, readout and laser delay. See the planner minimum and maximum frame rates.");
+	SetErrorText(ERR_NO_FRAME_COUNTER, "The firmware on the Mojo does not count frames. Please update the firmware.");
+	SetErrorText(ERR_NO_TIMESTAMPS, "The firmware on the Mojo does not timestamp the frames. Please update the firmware.");
+
+	// Description
+	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo camera trigger", MM::String, true);
+	assert(DEVICE_OK == ret);
+
+	// Name
+	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoCameraTrigger, MM::String, true);
+	assert(DEVICE_OK == ret);
+}
 
-		std::stringstream sstm;
-		sstm << "State" << i;
+MojoCameraTrigger::~MojoCameraTrigger()
+{
+	Shutdown();
+}
 
-		pExAct = new CPropertyActionEx (this, &MojoTTL::OnState,i);
-		nRet = CreateProperty(sstm.str().c_str(), "0", MM::Integer, false, pExAct);
+void MojoCameraTrigger::GetName(char* name) const
+{
+	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoCameraTrigger);
+}
+
+bool MojoCameraTrigger::Busy()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (hub == 0)
+		return false;
+	if (hub->IsBusy(this))
+		return true;
+
+	// until the board reports the last frame of the burst over
+	if (burst_){
+		long remaining;
+		if (GetFramesRemaining(remaining) != DEVICE_OK || remaining == 0)
+			burst_ = false;
+	}
+	return burst_;
+}
+
+int MojoCameraTrigger::Initialize()
+{
+	// Parent ID display	
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	char hubLabel[MM::MaxStrLength];
+	hub->GetLabel(hubLabel);
+	SetParentID(hubLabel);
+	CreateHubIDProperty();
+
+	const MojoRegisterMap& map = hub->GetRegisterMap();
+	if (map.activeTrigger < 0)
+		return ERR_NO_CAMERA_TRIGGER;
+	address_[ActiveTrigger] = map.activeTrigger;
+	address_[StartTrigger] = map.startTrigger;
+	address_[CameraPulse] = map.cameraPulse;
+	address_[CameraReadout] = map.cameraReadout;
+	address_[CameraExposure] = map.cameraExposure;
+	address_[LaserDelay] = map.laserDelay;
+	frameCountAddress_ = map.frameCount;
+	framesRemainingAddress_ = map.framesRemaining;
+	frameCounterAddress_ = map.frameCounter;
+	timestampLevelAddress_ = map.timestampLevel;
+	timestampAddress_ = map.timestamp;
+
+	// Passive: the camera triggers the lasers, active: the board fires the camera
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoCameraTrigger::OnActiveTrigger);
+	int nRet = CreateProperty("Trigger mode", "Passive", MM::String, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	AddAllowedValue("Trigger mode", "Passive");
+	AddAllowedValue("Trigger mode", "Active");
+
+	pAct = new CPropertyAction(this, &MojoCameraTrigger::OnStart);
+	nRet = CreateProperty("Start", "Off", MM::String, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	AddAllowedValue("Start", "Off");
+	AddAllowedValue("Start", "On");
+
+	// Durations, the width of the firmware registers sets the maximum
+	const char* names[] = {"Camera pulse (us)", "Camera readout (us)", "Camera exposure (us)", "Laser delay (us)"};
+	const long maxima[] = {1048575, 65535, 1048575, 65535};
+	for(int i=0;i<4;i++){
+		CPropertyActionEx* pExAct = new CPropertyActionEx(this, &MojoCameraTrigger::OnDuration, CameraPulse + i);
+		nRet = CreateProperty(names[i], "0", MM::Integer, false, pExAct);
 		if (nRet != DEVICE_OK)
 			return nRet;
-		AddAllowedValue(sstm.str().c_str(), "0");
-		AddAllowedValue(sstm.str().c_str(), "1");
+		SetPropertyLimits(names[i], 0, maxima[i]);
+	}
+
+	// Frame-rate planner: Plan computes the registers for the inputs, Apply
+	// also writes them. A frame rate out of the minimum to maximum range is
+	// refused.
+	const char* inputs[] = {"Planner frame rate (fps)", "Planner exposure (us)", "Planner camera readout (us)", "Planner laser delay (us)"};
+	const double inputMaxima[] = {1000000., 1048575., 65535., 65535.};
+	for(int i=0;i<NumPlannerInputs;i++){
+		std::ostringstream value;
+		value << plannerInput_[i];
+
+		CPropertyActionEx* pExAct = new CPropertyActionEx(this, &MojoCameraTrigger::OnPlannerInput, i);
+		nRet = CreateProperty(inputs[i], value.str().c_str(), MM::Float, false, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits(inputs[i], 0, inputMaxima[i]);
+	}
+
+	pAct = new CPropertyAction(this, &MojoCameraTrigger::OnPlanner);
+	nRet = CreateProperty("Planner", "Idle", MM::String, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	AddAllowedValue("Planner", "Idle");
+	AddAllowedValue("Planner", "Plan");
+	AddAllowedValue("Planner", "Apply");
+
+	const char* results[] = {"Planner minimum frame rate (fps)", "Planner maximum frame rate (fps)",
+		"Planner achieved frame rate (fps)", "Planner frame rate error (fps)", "Planner exposure error (us)"};
+	for(int i=0;i<5;i++){
+		CPropertyActionEx* pExAct = new CPropertyActionEx(this, &MojoCameraTrigger::OnPlan, i);
+		nRet = CreateProperty(results[i], "0", MM::Float, true, pExAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+	}
+
+	// Bursts of a number of frames counted by the board, with a firmware
+	// that has the frame count register
+	if (frameCountAddress_ >= 0){
+		pAct = new CPropertyAction(this, &MojoCameraTrigger::OnBurstFrames);
+		nRet = CreateProperty("Burst frames", "0", MM::Integer, false, pAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits("Burst frames", 0, 2147483647);
+
+		pAct = new CPropertyAction(this, &MojoCameraTrigger::OnBurst);
+		nRet = CreateProperty("Burst", "Idle", MM::String, false, pAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		AddAllowedValue("Burst", "Idle");
+		AddAllowedValue("Burst", "Start");
+		AddAllowedValue("Burst", "Stop");
+
+		pAct = new CPropertyAction(this, &MojoCameraTrigger::OnFramesRemaining);
+		nRet = CreateProperty("Frames remaining", "0", MM::Integer, true, pAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+	}
+
+	// Frame timing from the timestamps of the board: Update drains them,
+	// Reset clears the frame counter and the timing, and restarts the sequences
+	if (frameCounterAddress_ >= 0){
+		pAct = new CPropertyAction(this, &MojoCameraTrigger::OnFrameCounter);
+		nRet = CreateProperty("Frame counter", "0", MM::Integer, true, pAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+
+		pAct = new CPropertyAction(this, &MojoCameraTrigger::OnFrameTimingAction);
+		nRet = CreateProperty("Frame timing", "Idle", MM::String, false, pAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		AddAllowedValue("Frame timing", "Idle");
+		AddAllowedValue("Frame timing", "Update");
+		AddAllowedValue("Frame timing", "Reset");
+
+		const char* timing[] = {"Frame timing timestamps", "Frame timing lost timestamps", "Frame timing missed frames",
+			"Frame timing period (us)", "Frame timing mean interval (us)", "Frame timing jitter (us)", "Frame timing maximum jitter (us)"};
+		for(int i=0;i<7;i++){
+			CPropertyActionEx* pExAct = new CPropertyActionEx(this, &MojoCameraTrigger::OnFrameTiming, i);
+			nRet = CreateProperty(timing[i], "0", i < 3 ? MM::Integer : MM::Float, true, pExAct);
+			if (nRet != DEVICE_OK)
+				return nRet;
+		}
 	}
 
 	nRet = UpdateStatus();
 	if (nRet != DEVICE_OK)
 		return nRet;
 
-	initialized_ = true;
+	initialized_ = true;
+
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::Shutdown()
+{
+	initialized_ = false;
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::WriteToPort(long index, long value)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// queued on the hub I/O thread, Busy() reports until it is sent
+	return hub->PostWrite(this, address_[index], value);
+}
+
+int MojoCameraTrigger::RefreshFromPort()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// the camera trigger registers are consecutive in the register map
+	int ret = hub->ReadRegisters(address_[ActiveTrigger], NumRegisters, state_);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::PlanFrameRate(double frameRate, double exposureUs, double readoutUs, double delayUs, MojoFramePlan& plan)
+{
+	// limits of the camera_trigger.luc registers
+	const long maxLong = 1048575;	// 20 bits: pulse and exposure
+	const long maxShort = 65535;	// 16 bits: readout and delay
+
+	if (frameRate <= 0 || exposureUs < 0 || readoutUs < 0 || delayUs < 0)
+		return ERR_FRAME_PLAN;
+
+	// the registers count whole microseconds, the readout of the camera is a minimum
+	plan.exposure = std::max(1L, static_cast<long>(floor(exposureUs + 0.5)));
+	plan.delay = static_cast<long>(floor(delayUs + 0.5));
+	const long minReadout = static_cast<long>(ceil(readoutUs));
+	if (plan.exposure > maxLong || plan.delay > maxShort || minReadout > maxShort)
+		return ERR_FRAME_PLAN;
+
+	// period = delay + exposure + readout, the closest to the requested one,
+	// the readout register bounds the range of the frame rates
+	const long fixed = plan.delay + plan.exposure;
+	const long period = static_cast<long>(floor(1000000. / frameRate + 0.5));
+	plan.minFrameRate = 1000000. / (fixed + maxShort);
+	plan.maxFrameRate = 1000000. / (fixed + minReadout);
+	if (period - fixed < minReadout || period - fixed > maxShort)
+		return ERR_FRAME_RATE_RANGE;
+	plan.readout = period - fixed;
+
+	// the fire pulse lasts the exposure, for cameras triggered on the edge
+	// as well as on the level
+	plan.pulse = plan.exposure;
+
+	plan.frameRate = 1000000. / period;
+	plan.frameRateError = plan.frameRate - frameRate;
+	plan.exposureError = plan.exposure - exposureUs;
+
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::ApplyFramePlan(const MojoFramePlan& plan)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+
+	// only the requested period rounded to the microsecond is written
+	const double requestedUs = 1000000. / (plan.frameRate - plan.frameRateError);
+	if (fabs(plan.delay + plan.exposure + plan.readout - requestedUs) > 0.5 + 1e-6)
+		return ERR_FRAME_RATE_RANGE;
+
+	// pulse, readout, exposure and delay are consecutive registers, a single
+	// burst changes the period at once
+	const long values[] = {plan.pulse, plan.readout, plan.exposure, plan.delay};
+	std::vector<unsigned char> frame;
+	MojoHub::AppendWriteFrame(frame, address_[CameraPulse], values, 4);
+
+	int ret = hub->PostFrame(this, frame);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	std::copy(values, values + 4, state_ + CameraPulse);
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::StartBurst(long frames)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	if (frameCountAddress_ < 0)
+		return ERR_NO_FRAME_COUNTER;
+	if (frames < 0)
+		return DEVICE_INVALID_PROPERTY_VALUE;
+
+	// the frame count, then the start that loads it, in a single transfer
+	const long start = 1;
+	std::vector<unsigned char> frame;
+	MojoHub::AppendWriteFrame(frame, frameCountAddress_, &frames, 1);
+	MojoHub::AppendWriteFrame(frame, address_[StartTrigger], &start, 1);
+
+	int ret = hub->PostFrame(this, frame);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	// only the active trigger counts frames
+	long active;
+	ret = hub->ReadRegisters(address_[ActiveTrigger], 1, &active);
+	burst_ = ret == DEVICE_OK && active != 0 && frames > 0;
+	return ret;
+}
+
+int MojoCameraTrigger::StopBurst()
+{
+	// the frame in progress completes
+	burst_ = false;
+	return WriteToPort(StartTrigger, 0);
+}
+
+int MojoCameraTrigger::GetFramesRemaining(long& frames)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	if (framesRemainingAddress_ < 0)
+		return ERR_NO_FRAME_COUNTER;
+
+	// volatile, always read from the board
+	return hub->ReadRegisters(framesRemainingAddress_, 1, &frames);
+}
+
+int MojoCameraTrigger::ResetFrameTiming()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	if (frameCounterAddress_ < 0)
+		return ERR_NO_TIMESTAMPS;
+
+	// any write clears the frame counter and the queue of timestamps, and
+	// restarts the laser and TTL sequences on their first step
+	int ret = hub->PostWrite(this, frameCounterAddress_, 0);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	timing_.frames = 0;
+	timing_.timestamps = 0;
+	timing_.lostTimestamps = 0;
+	timing_.missedFrames = 0;
+	timing_.periodUs = 0.;
+	timing_.meanIntervalUs = 0.;
+	timing_.jitterUs = 0.;
+	timing_.maxJitterUs = 0.;
+	singleIntervals_ = 0;
+	intervalSum_ = 0.;
+	intervalSquares_ = 0.;
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::DrainTimestamps(std::vector<unsigned long>& timestamps)
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	if (!hub) {
+		return ERR_NO_PORT_SET;
+	}
+	if (frameCounterAddress_ < 0)
+		return ERR_NO_TIMESTAMPS;
+
+	// the frame counter and the number of timestamps queued, read together,
+	// then the timestamps in bursts
+	long status[2];
+	int ret = hub->ReadRegisters(frameCounterAddress_, 2, status);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	std::vector<long> words(std::max(0L, status[1]));
+	ret = hub->ReadQueue(timestampAddress_, static_cast<long>(words.size()), words.empty() ? 0 : &words[0]);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	std::vector<unsigned long> drained(words.size());
+	for(size_t i=0;i<words.size();i++){
+		drained[i] = static_cast<unsigned long>(words[i]) & 0xFFFFFFFFUL;
+	}
+	timestamps.insert(timestamps.end(), drained.begin(), drained.end());
+
+	// The expected period is the one of the active trigger, or the mean
+	// interval with a camera triggering the board (from the shadow registers)
+	std::vector<long> addresses, trigger;
+	addresses.push_back(address_[ActiveTrigger]);
+	addresses.push_back(address_[CameraReadout]);
+	addresses.push_back(address_[CameraExposure]);
+	addresses.push_back(address_[LaserDelay]);
+	ret = hub->ReadRegisters(addresses, trigger);
+	if (ret != DEVICE_OK)
+		return ret;
+	AddTimestamps(drained, trigger[0] ? static_cast<double>(trigger[1] + trigger[2] + trigger[3]) : 0.);
+
+	// The frames counted before the read of the queue level are either
+	// drained or lost. An edge between the two reads is only counted at the
+	// next drain.
+	timing_.frames = status[0];
+	const int lost = static_cast<int>(static_cast<unsigned long>(status[0]) - timing_.timestamps);
+	timing_.lostTimestamps = std::max(0, lost);
+	return DEVICE_OK;
+}
+
+void MojoCameraTrigger::AddTimestamps(const std::vector<unsigned long>& timestamps, double periodUs)
+{
+	for(size_t i=0;i<timestamps.size();i++){
+		const unsigned long t = timestamps[i];
+		if (timing_.timestamps++ == 0){
+			lastTimestamp_ = t;
+			continue;
+		}
+
+		// the clock of the board wraps on 32 bits
+		const double interval = static_cast<double>((t - lastTimestamp_) & 0xFFFFFFFFUL);
+		lastTimestamp_ = t;
+
+		double period = periodUs;
+		if (period <= 0)
+			period = singleIntervals_ > 0 ? intervalSum_ / singleIntervals_ : interval;
+		if (period <= 0)
+			period = 1.;
+
+		const long frames = std::max(1L, static_cast<long>(floor(interval / period + 0.5)));
+		if (frames > 1){
+			timing_.missedFrames += frames - 1;
+			continue;
+		}
+
+		singleIntervals_++;
+		intervalSum_ += interval;
+		intervalSquares_ += interval * interval;
+		timing_.maxJitterUs = std::max(timing_.maxJitterUs, fabs(interval - period));
+		timing_.periodUs = period;
+	}
+
+	if (singleIntervals_ > 0){
+		timing_.meanIntervalUs = intervalSum_ / singleIntervals_;
+		const double variance = intervalSquares_ / singleIntervals_ - timing_.meanIntervalUs * timing_.meanIntervalUs;
+		timing_.jitterUs = sqrt(std::max(0., variance));
+	}
+}
+
+int MojoCameraTrigger::GetFrameTiming(MojoFrameTiming& timing)
+{
+	std::vector<unsigned long> timestamps;
+	int ret = DrainTimestamps(timestamps);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	timing = timing_;
+	return DEVICE_OK;
+}
+
+///////////////////////////////////////
+/////////// Action handlers
+int MojoCameraTrigger::OnActiveTrigger(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(state_[ActiveTrigger] ? "Active" : "Passive");
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		std::string mode;
+		pProp->Get(mode);
+
+		int ret = WriteToPort(ActiveTrigger, mode == "Active" ? 1 : 0);
+		if (ret != DEVICE_OK)
+			return ret;
+	}
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::OnStart(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(state_[StartTrigger] ? "On" : "Off");
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		std::string start;
+		pProp->Get(start);
+
+		int ret = WriteToPort(StartTrigger, start == "On" ? 1 : 0);
+		if (ret != DEVICE_OK)
+			return ret;
+
+		// the start also runs a burst if the frame count is set (active trigger)
+		burst_ = start == "On" && frameCountAddress_ >= 0;
+		if (burst_){
+			MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+			long active;
+			burst_ = hub->ReadRegisters(address_[ActiveTrigger], 1, &active) == DEVICE_OK && active != 0;
+		}
+	}
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::OnDuration(MM::PropertyBase* pProp, MM::ActionType pAct, long index)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		int ret = RefreshFromPort();
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(state_[index]);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		long duration;
+		pProp->Get(duration);
+
+		int ret = WriteToPort(index, duration);
+		if (ret != DEVICE_OK)
+			return ret;
+	}
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::OnPlannerInput(MM::PropertyBase* pProp, MM::ActionType pAct, long index)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(plannerInput_[index]);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(plannerInput_[index]);
+	}
+	return DEVICE_OK;
+}
+
+int MojoCameraTrigger::OnPlanner(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set("Idle");
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		std::string action;
+		pProp->Get(action);
+		pProp->Set("Idle");
+
+		if (action == "Idle")
+			return DEVICE_OK;
+
+		int ret = PlanFrameRate(plannerInput_[PlanFrameRateInput], plannerInput_[PlanExposureInput],
+			plannerInput_[PlanReadoutInput], plannerInput_[PlanDelayInput], plan_);
+		if (ret != DEVICE_OK)
+			return ret;
 
+		if (action == "Apply")
+			return ApplyFramePlan(plan_);
+	}
 	return DEVICE_OK;
 }
 
-int MojoTTL::Shutdown()
+int MojoCameraTrigger::OnPlan(MM::PropertyBase* pProp, MM::ActionType pAct, long index)
 {
-	initialized_ = false;
+	if (pAct == MM::BeforeGet)
+	{
+		const double results[] = {plan_.minFrameRate, plan_.maxFrameRate, plan_.frameRate, plan_.frameRateError, plan_.exposureError};
+		pProp->Set(results[index]);
+	}
 	return DEVICE_OK;
 }
 
-int MojoTTL::WriteToPort(long address, long state)
+int MojoCameraTrigger::OnBurstFrames(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set(burstFrames_);
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		pProp->Get(burstFrames_);
 	}
-
-	MMThreadGuard myLock(hub->GetLock());
-
-	hub->PurgeComPortH();
-
-	int val = 0;
-	if(state == 1){
-		val = 1;
-	} 
-	int ret = hub->SendWriteRequest(address, val);
-	if (ret != DEVICE_OK)
-		return ret;
-
 	return DEVICE_OK;
 }
 
-int MojoTTL::ReadFromPort(long& answer)
+int MojoCameraTrigger::OnBurst(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set("Idle");
+	}
+	else if (pAct == MM::AfterSet)
+	{
+		std::string action;
+		pProp->Get(action);
+		pProp->Set("Idle");
+
+		if (action == "Start")
+			return StartBurst(burstFrames_);
+		if (action == "Stop")
+			return StopBurst();
 	}
-	int ret = hub->ReadAnswer(answer);
-	if (ret != DEVICE_OK)
-		return ret;
-
 	return DEVICE_OK;
 }
 
-///////////////////////////////////////
-/////////// Action handlers
-int MojoTTL::OnNumberOfChannels(MM::PropertyBase* pProp, MM::ActionType pAct)
+int MojoCameraTrigger::OnFramesRemaining(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	if (pAct == MM::BeforeGet){
-		pProp->Set(numChannels_);
-	} else if (pAct == MM::AfterSet){
-		pProp->Get(numChannels_);
+	if (pAct == MM::BeforeGet)
+	{
+		long frames;
+		int ret = GetFramesRemaining(frames);
+		if (ret != DEVICE_OK)
+			return ret;
+
+		pProp->Set(frames);
 	}
 	return DEVICE_OK;
 }
 
-int MojoTTL::OnState(MM::PropertyBase* pProp, MM::ActionType pAct, long channel)
+int MojoCameraTrigger::OnFrameCounter(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
 	if (pAct == MM::BeforeGet)
 	{
 		MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-		if (!hub){
+		if (!hub) {
 			return ERR_NO_PORT_SET;
 		}
 
-		MMThreadGuard myLock(hub->GetLock());
-
-		int ret = hub->SendReadRequest(g_offsetaddressTTL+channel);
+		long frames;
+		int ret = hub->ReadRegisters(frameCounterAddress_, 1, &frames);
 		if (ret != DEVICE_OK)
 			return ret;
 
-		long answer;
-		ret = ReadFromPort(answer);
-		if (ret != DEVICE_OK)
-			return ret;
+		pProp->Set(frames);
+	}
+	return DEVICE_OK;
+}
 
-		pProp->Set(answer);
-		state_[channel]=answer;
+int MojoCameraTrigger::OnFrameTimingAction(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		pProp->Set("Idle");
 	}
 	else if (pAct == MM::AfterSet)
 	{
-		long pos;
-		pProp->Get(pos);
+		std::string action;
+		pProp->Get(action);
+		pProp->Set("Idle");
 
-		int ret = WriteToPort(g_offsetaddressTTL+channel, pos); 
-		if (ret != DEVICE_OK)
-			return ret;
-
-		state_[channel] = pos;
+		if (action == "Update"){
+			std::vector<unsigned long> timestamps;
+			return DrainTimestamps(timestamps);
+		}
+		if (action == "Reset")
+			return ResetFrameTiming();
 	}
-
 	return DEVICE_OK;
 }
 
+int MojoCameraTrigger::OnFrameTiming(MM::PropertyBase* pProp, MM::ActionType pAct, long index)
+{
+	if (pAct == MM::BeforeGet)
+	{
+		const double results[] = {static_cast<double>(timing_.timestamps), static_cast<double>(timing_.lostTimestamps),
+			static_cast<double>(timing_.missedFrames), timing_.periodUs, timing_.meanIntervalUs, timing_.jitterUs, timing_.maxJitterUs};
+		if (index < 3)
+			pProp->Set(static_cast<long>(results[index]));
+		else
+			pProp->Set(results[index]);
+	}
+	return DEVICE_OK;
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 //////
-MojoServo::MojoServo() :
+MojoInput::MojoInput() :
 initialized_ (false),
-	busy_(false)
+	samplerHub_(0),
+	samplerRunning_(false),
+	stopSampler_(false),
+	samplerRate_(100.),
+	achievedRate_(0.),
+	droppedSamples_(0),
+	recordingFile_("MojoAnalogInput.bin"),
+	recordingChannels_(1),
+	recordingDecimation_(1),
+	streamChannelsAddress_(-1),
+	streamLevelAddress_(-1),
+	streamSampleAddress_(-1),
+	streamHub_(0),
+	streamRunning_(false),
+	stopStream_(false),
+	streamReceived_(0),
+	streamLost_(0),
+	streamDropped_(0),
+	streamRate_(0.),
+	streamIndex_(0),
+	streamChannels_(1),
+	streamDecimation_(1),
+	stream_(g_streamCapacity)
 {
 	InitializeDefaultErrorMessages();
 
 	// Custom error messages
 	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
 	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+	SetErrorText(ERR_CHANNELS_UNAVAILABLE, "The firmware on the Mojo does not provide that many channels.");
+	SetErrorText(ERR_RECORDING_FAILED, "Could not create or extend the analog input recording file.");
+	SetErrorText(ERR_NO_SAMPLE_STREAM, "The firmware on the Mojo does not stream analog samples. Please update the firmware.");
 
 	// Description
-	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo Servo controller", MM::String, true);
+	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo AnalogInput", MM::String, true);
 	assert(DEVICE_OK == ret);
 
 	// Name
-	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoServos, MM::String, true);
+	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoInput, MM::String, true);
 	assert(DEVICE_OK == ret);
 
-	// Number of servos
-	CPropertyAction* pAct = new CPropertyAction(this, &MojoServo::OnNumberOfServos);
-	CreateProperty("Number of Servos", "4", MM::Integer, false, pAct, true);
-	SetPropertyLimits("Number of Servos", 1, g_maxservos);
+	// Number of Analog input channels
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoInput::OnNumberOfChannels);
+	CreateProperty("Number of channels", "3", MM::Integer, false, pAct, true);
+	SetPropertyLimits("Number of channels", 1, g_maxanaloginput);
 }
 
-MojoServo::~MojoServo()
+MojoInput::~MojoInput()
 {
 	Shutdown();
 }
 
-void MojoServo::GetName(char* name) const
+void MojoInput::GetName(char* name) const
 {
-	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoServos);
+	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoInput);
 }
 
+bool MojoInput::Busy()
+{
+	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
+	return hub != 0 && hub->IsBusy(this);
+}
 
-int MojoServo::Initialize()
+int MojoInput::Initialize()
 {
 	// Parent ID display	
 	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
@@ -840,238 +5038,355 @@ int MojoServo::Initialize()
 	SetParentID(hubLabel);
 	CreateHubIDProperty();
 
+	const MojoRegisterMap& map = hub->GetRegisterMap();
+	if (GetNumberOfChannels() > (unsigned long) map.maxAnalogInput)
+		return ERR_CHANNELS_UNAVAILABLE;
+	address_ = map.analogInput;
+	streamChannelsAddress_ = map.sampleChannels;
+	streamLevelAddress_ = map.sampleLevel;
+	streamSampleAddress_ = map.sample;
+
 	// State
 	// -----
 
-	// Allocate memory for servos
-	position_ = new long [GetNumberOfServos()];
+	// Allocate memory for inputs
+	state_ = new long [GetNumberOfChannels()];
 
 	CPropertyActionEx *pExAct;
 	int nRet;
 
-	for(unsigned int i=0;i<GetNumberOfServos();i++){	
-		position_[i] = 0;
+	for(unsigned int i=0;i<GetNumberOfChannels();i++){
+		state_[i] = 0;
 
 		std::stringstream sstm;
-		sstm << "Position" << i;
+		sstm << "AnalogInput" << i;
 
-		pExAct = new CPropertyActionEx (this, &MojoServo::OnPosition,i);
-		nRet = CreateProperty(sstm.str().c_str(), "0", MM::Integer, false, pExAct);
+		pExAct = new CPropertyActionEx (this, &MojoInput::OnAnalogInput,i);
+		nRet = CreateProperty(sstm.str().c_str(), "0", MM::Integer, true, pExAct);
 		if (nRet != DEVICE_OK)
 			return nRet;
-		SetPropertyLimits(sstm.str().c_str(), 0, 65535);
 	}
 
-	nRet = UpdateStatus();
+	// Background sampler: polls all channels and serves the property reads
+	CPropertyAction* pAct = new CPropertyAction(this, &MojoInput::OnSampler);
+	nRet = CreateProperty("Sampler", "Off", MM::String, false, pAct);
 	if (nRet != DEVICE_OK)
 		return nRet;
+	AddAllowedValue("Sampler", "Off");
+	AddAllowedValue("Sampler", "On");
 
-	initialized_ = true;
+	pAct = new CPropertyAction(this, &MojoInput::OnSamplerRate);
+	nRet = CreateProperty("Sampler rate (Hz)", "100", MM::Float, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	SetPropertyLimits("Sampler rate (Hz)", 1, 1000);
 
-	return DEVICE_OK;
-}
+	pAct = new CPropertyAction(this, &MojoInput::OnSamplerAchievedRate);
+	nRet = CreateProperty("Sampler achieved rate (Hz)", "0", MM::Float, true, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
 
-int MojoServo::Shutdown()
-{
-	initialized_ = false;
-	return DEVICE_OK;
-}
+	pAct = new CPropertyAction(this, &MojoInput::OnSamplerDropped);
+	nRet = CreateProperty("Sampler dropped samples", "0", MM::Integer, true, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
 
-int MojoServo::WriteToPort(long address, long value)
-{
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
-	}
+	pAct = new CPropertyAction(this, &MojoInput::OnSamplerTimestamp);
+	nRet = CreateProperty("Sampler timestamp (ms)", "0", MM::Float, true, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
 
-	MMThreadGuard myLock(hub->GetLock());
+	// Recording of the sampled channels to a memory-mapped file
+	pAct = new CPropertyAction(this, &MojoInput::OnRecordingFile);
+	nRet = CreateProperty("Recording file", recordingFile_.c_str(), MM::String, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
 
-	hub->PurgeComPortH();
+	pAct = new CPropertyAction(this, &MojoInput::OnRecordingChannels);
+	nRet = CreateProperty("Recording channel mask", "1", MM::Integer, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	SetPropertyLimits("Recording channel mask", 1, (1 << GetNumberOfChannels()) - 1);
 
+	pAct = new CPropertyAction(this, &MojoInput::OnRecordingDecimation);
+	nRet = CreateProperty("Recording decimation", "1", MM::Integer, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	SetPropertyLimits("Recording decimation", 1, 10000);
 
-	int ret = hub->SendWriteRequest(address, value);
-	if (ret != DEVICE_OK)
-		return ret;
+	pAct = new CPropertyAction(this, &MojoInput::OnRecording);
+	nRet = CreateProperty("Recording", "Off", MM::String, false, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
+	AddAllowedValue("Recording", "Off");
+	AddAllowedValue("Recording", "On");
 
-	return DEVICE_OK;
-}
+	pAct = new CPropertyAction(this, &MojoInput::OnRecordedSamples);
+	nRet = CreateProperty("Recorded samples", "0", MM::Integer, true, pAct);
+	if (nRet != DEVICE_OK)
+		return nRet;
 
-int MojoServo::ReadFromPort(long& answer)
-{
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
-	}
-	int ret = hub->ReadAnswer(answer);
-	if (ret != DEVICE_OK)
-		return ret;
+	// Stream of every sample of the enabled channels, with a firmware that
+	// queues them
+	if (streamChannelsAddress_ >= 0){
+		pAct = new CPropertyAction(this, &MojoInput::OnStreamChannels);
+		nRet = CreateProperty("Stream channel mask", "1", MM::Integer, false, pAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits("Stream channel mask", 1, (1 << GetNumberOfChannels()) - 1);
 
-	return DEVICE_OK;
-}
+		pAct = new CPropertyAction(this, &MojoInput::OnStreamDecimation);
+		nRet = CreateProperty("Stream decimation", "1", MM::Integer, false, pAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		SetPropertyLimits("Stream decimation", 1, 65536);
 
+		pAct = new CPropertyAction(this, &MojoInput::OnStream);
+		nRet = CreateProperty("Stream", "Off", MM::String, false, pAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
+		AddAllowedValue("Stream", "Off");
+		AddAllowedValue("Stream", "On");
 
-///////////////////////////////////////
-/////////// Action handlers
-int MojoServo::OnNumberOfServos(MM::PropertyBase* pProp, MM::ActionType pAct)
-{
-	if (pAct == MM::BeforeGet){
-		pProp->Set(numServos_);
-	} else if (pAct == MM::AfterSet){
-		pProp->Get(numServos_);
-	}
-	return DEVICE_OK;
-}
+		pAct = new CPropertyAction(this, &MojoInput::OnStreamRate);
+		nRet = CreateProperty("Stream rate (Hz)", "0", MM::Float, true, pAct);
+		if (nRet != DEVICE_OK)
+			return nRet;
 
-int MojoServo::OnPosition(MM::PropertyBase* pProp, MM::ActionType pAct, long servo)
-{
-	if (pAct == MM::BeforeGet)
-	{
-		MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-		if (!hub){
-			return ERR_NO_PORT_SET;
+		const char* counters[] = {"Stream received samples", "Stream lost samples", "Stream dropped samples", "Stream buffered samples"};
+		for(int i=0;i<4;i++){
+			pExAct = new CPropertyActionEx(this, &MojoInput::OnStreamCounter, i);
+			nRet = CreateProperty(counters[i], "0", MM::Integer, true, pExAct);
+			if (nRet != DEVICE_OK)
+				return nRet;
 		}
+	}
 
-		MMThreadGuard myLock(hub->GetLock());
+	nRet = UpdateStatus();
+	if (nRet != DEVICE_OK)
+		return nRet;
 
-		int ret = hub->SendReadRequest(g_offsetaddressServo+servo);
-		if (ret != DEVICE_OK)
-			return ret;
+	initialized_ = true;
 
-		long answer;
-		ret = ReadFromPort(answer);
-		if (ret != DEVICE_OK)
-			return ret;
+	return DEVICE_OK;
+}
 
+int MojoInput::Shutdown()
+{
+	StopSampler();
+	StopStream();
 
-		pProp->Set(answer);
-		position_[servo]=answer;
-	}
-	else if (pAct == MM::AfterSet)
 	{
-		long pos;
-		pProp->Get(pos);
-
-		int ret = WriteToPort(g_offsetaddressServo+servo,pos); 
-		if (ret != DEVICE_OK)
-			return ret;
-
-		position_[servo] = pos;
+		std::lock_guard<std::mutex> guard(recorderMutex_);
+		recorder_.Close();
 	}
 
+	initialized_ = false;
 	return DEVICE_OK;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////
-//////
-MojoPWM::MojoPWM() :
-initialized_ (false),
-	busy_(false)
+bool MojoInput::GetLatestSamples(long* values, MM::MMTime& time) const
 {
-	InitializeDefaultErrorMessages();
+	return samples_.Latest(values, numChannels_, time);
+}
 
-	// Custom error messages
-	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
-	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
+int MojoInput::StartSampler()
+{
+	if (samplerRunning_)
+		return DEVICE_OK;
 
-	// Description
-	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo PWM controller", MM::String, true);
-	assert(DEVICE_OK == ret);
+	samplerHub_ = static_cast<MojoHub*>(GetParentHub());
+	if (!samplerHub_) {
+		return ERR_NO_PORT_SET;
+	}
 
-	// Name
-	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoPWM, MM::String, true);
-	assert(DEVICE_OK == ret);
+	samples_.Reset();
+	droppedSamples_ = 0;
+	achievedRate_ = 0.;
+	stopSampler_ = false;
+	samplerRunning_ = true;
+	samplerThread_ = std::thread(&MojoInput::SamplerThread, this);
 
-	// Number of PWM channels
-	CPropertyAction* pAct = new CPropertyAction(this, &MojoPWM::OnNumberOfChannels);
-	CreateProperty("Number of PWM", "1", MM::Integer, false, pAct, true);
-	SetPropertyLimits("Number of PWM", 1, g_maxpwm);
+	return DEVICE_OK;
 }
 
-MojoPWM::~MojoPWM()
+void MojoInput::StopSampler()
 {
-	Shutdown();
+	if (!samplerRunning_)
+		return;
+
+	stopSampler_ = true;
+	samplerThread_.join();
+	samplerRunning_ = false;
+	achievedRate_ = 0.;
 }
 
-void MojoPWM::GetName(char* name) const
+void MojoInput::SamplerThread()
 {
-	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoPWM);
-}
+	long values[MojoSampleRing::maxChannels];
 
+	MM::MMTime next = GetCurrentMMTime();
+	MM::MMTime windowStart = next;
+	long windowSamples = 0;
 
-int MojoPWM::Initialize()
-{
-	// Parent ID display	
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
-	}
-	char hubLabel[MM::MaxStrLength];
-	hub->GetLabel(hubLabel);
-	SetParentID(hubLabel);
-	CreateHubIDProperty();
+	while (!stopSampler_){
+		// the reads are queued with the other hub transactions
+		int ret = samplerHub_->SendRead(samplerHub_, address_, GetNumberOfChannels(), values);
 
-	// State
-	// -----
+		MM::MMTime now = GetCurrentMMTime();
+		if (ret == DEVICE_OK){
+			samples_.Publish(values, GetNumberOfChannels(), now);
+			windowSamples++;
+
+			std::lock_guard<std::mutex> guard(recorderMutex_);
+			if (recorder_.IsOpen() && recorder_.Add(values, now) != DEVICE_OK){
+				LogMessage("Analog input recording stopped: could not extend the recording file");
+				recorder_.Close();
+			}
+		} else {
+			droppedSamples_++;
+		}
 
-	// Allocate memory for channels
-	state_ = new long [GetNumberOfChannels()];
+		// achieved rate, averaged over one second
+		const double windowMs = (now - windowStart).getMsec();
+		if (windowMs >= 1000.){
+			achievedRate_ = windowSamples * 1000. / windowMs;
+			windowStart = now;
+			windowSamples = 0;
+		}
 
-	CPropertyActionEx *pExAct;
-	int nRet;
+		// schedule the next sample, periods that were missed count as dropped
+		const double periodUs = 1e6 / samplerRate_;
+		next = next + MM::MMTime(periodUs);
+		if (now > next){
+			const long missed = static_cast<long>((now - next).getUsec() / periodUs);
+			droppedSamples_ += missed;
+			next = next + MM::MMTime(missed * periodUs);
+		} else {
+			std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>((next - now).getUsec())));
+		}
+	}
+}
 
-	for(unsigned int i=0;i<GetNumberOfChannels();i++){
-		state_[i] = 0;
+int MojoInput::StartStream(unsigned long channelMask, long decimation)
+{
+	if (streamChannelsAddress_ < 0)
+		return ERR_NO_SAMPLE_STREAM;
+	if (channelMask == 0 || channelMask >= (1UL << GetNumberOfChannels()) || decimation < 1 || decimation > 65536)
+		return DEVICE_INVALID_PROPERTY_VALUE;
 
-		std::stringstream sstm;
-		sstm << "Position" << i;
+	StopStream();
 
-		pExAct = new CPropertyActionEx (this, &MojoPWM::OnState,i);
-		nRet = CreateProperty(sstm.str().c_str(), "0", MM::Integer, false, pExAct);
-		if (nRet != DEVICE_OK)
-			return nRet;
-		SetPropertyLimits(sstm.str().c_str(), 0, 255);
+	streamHub_ = static_cast<MojoHub*>(GetParentHub());
+	if (!streamHub_) {
+		return ERR_NO_PORT_SET;
 	}
 
-	nRet = UpdateStatus();
-	if (nRet != DEVICE_OK)
-		return nRet;
+	// the channel mask clears the queue and the counter of the board, the
+	// stream thread reads after it
+	const long values[] = {static_cast<long>(channelMask), decimation - 1};
+	std::vector<unsigned char> frame;
+	MojoHub::AppendWriteFrame(frame, streamChannelsAddress_, values, 2);
+	int ret = streamHub_->PostFrame(this, frame);
+	if (ret != DEVICE_OK)
+		return ret;
 
-	initialized_ = true;
+	stream_.Reset();
+	streamIndex_ = 0;
+	streamReceived_ = 0;
+	streamLost_ = 0;
+	streamDropped_ = 0;
+	streamRate_ = 0.;
+	stopStream_ = false;
+	streamRunning_ = true;
+	streamThread_ = std::thread(&MojoInput::StreamThread, this);
 
 	return DEVICE_OK;
 }
 
-int MojoPWM::Shutdown()
+void MojoInput::StopStream()
 {
-	initialized_ = false;
-	return DEVICE_OK;
+	if (!streamRunning_)
+		return;
+
+	stopStream_ = true;
+	streamThread_.join();
+	streamRunning_ = false;
+	streamRate_ = 0.;
+
+	// no channel left, the board stops queueing samples
+	streamHub_->PostWrite(this, streamChannelsAddress_, 0);
 }
 
-int MojoPWM::WriteToPort(long address, long position)
+size_t MojoInput::ReadStream(MojoStreamSample* samples, size_t max)
 {
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
-	}
-
-	MMThreadGuard myLock(hub->GetLock());
+	return stream_.Pop(samples, max);
+}
 
-	hub->PurgeComPortH();
+void MojoInput::StreamThread()
+{
+	std::vector<long> words;
+
+	MM::MMTime windowStart = GetCurrentMMTime();
+	unsigned long long windowSamples = 0;
+
+	while (!stopStream_){
+		// the number of samples queued, then the samples in bursts
+		long queued;
+		int ret = streamHub_->ReadRegisters(streamLevelAddress_, 1, &queued);
+		words.clear();
+		if (ret == DEVICE_OK && queued > 0){
+			words.resize(std::min(queued, g_streamBurstWords));
+			ret = streamHub_->ReadQueue(streamSampleAddress_, static_cast<long>(words.size()), &words[0]);
+		}
+		if (ret != DEVICE_OK){
+			LogMessage("Analog input stream: could not read the samples of the board");
+			words.clear();
+		}
 
-	int ret = hub->SendWriteRequest(address, position);
-	if (ret != DEVICE_OK)
-		return ret;
+		for(size_t i=0;i<words.size();i++){
+			// {counter[19], channel[3], value[10]}, the counter skips the
+			// samples lost on the board
+			const unsigned long word = static_cast<unsigned long>(words[i]);
+			const unsigned long counter = (word >> 13) & 0x7FFFF;
+			const unsigned long lost = (counter - static_cast<unsigned long>(streamIndex_)) & 0x7FFFF;
+			streamLost_ += lost;
+			streamIndex_ += lost;
+
+			MojoStreamSample sample;
+			sample.index = streamIndex_++;
+			sample.channel = static_cast<int>((word >> 10) & 0x7);
+			sample.value = static_cast<long>(word & 0x3FF);
+			if (!stream_.Push(sample))
+				streamDropped_++;
+		}
+		streamReceived_ += words.size();
+		windowSamples += words.size();
+
+		// rate averaged over one second
+		const MM::MMTime now = GetCurrentMMTime();
+		const double windowMs = (now - windowStart).getMsec();
+		if (windowMs >= 1000.){
+			streamRate_ = windowSamples * 1000. / windowMs;
+			windowStart = now;
+			windowSamples = 0;
+		}
 
-	return DEVICE_OK;
+		// drained as long as the board has samples, then polled
+		if (ret != DEVICE_OK || static_cast<long>(words.size()) >= queued)
+			std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>(g_streamPollMs * 1000.)));
+	}
 }
 
-int MojoPWM::ReadFromPort(long& answer)
+int MojoInput::RefreshFromPort()
 {
 	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
 	if (!hub) {
 		return ERR_NO_PORT_SET;
 	}
-	int ret = hub->ReadAnswer(answer);
+
+	// Analog inputs are read in a single burst
+	int ret = hub->ReadRegisters(address_, GetNumberOfChannels(), state_);
 	if (ret != DEVICE_OK)
 		return ret;
 
@@ -1080,7 +5395,7 @@ int MojoPWM::ReadFromPort(long& answer)
 
 ///////////////////////////////////////
 /////////// Action handlers
-int MojoPWM::OnNumberOfChannels(MM::PropertyBase* pProp, MM::ActionType pAct)
+int MojoInput::OnNumberOfChannels(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
 	if (pAct == MM::BeforeGet){
 		pProp->Set(numChannels_);
@@ -1090,201 +5405,308 @@ int MojoPWM::OnNumberOfChannels(MM::PropertyBase* pProp, MM::ActionType pAct)
 	return DEVICE_OK;
 }
 
-int MojoPWM::OnState(MM::PropertyBase* pProp, MM::ActionType pAct, long channel)
+int MojoInput::OnAnalogInput(MM::PropertyBase* pProp, MM::ActionType pAct, long channel)
 {
-	if (pAct == MM::BeforeGet)
-	{
-		MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-		if (!hub){
-			return ERR_NO_PORT_SET;
+	if (pAct == MM::BeforeGet){
+		// served by the sampler without touching the port
+		MM::MMTime time;
+		if (samplerRunning_ && samples_.Latest(state_, GetNumberOfChannels(), time)){
+			pProp->Set(state_[channel]);
+			return DEVICE_OK;
 		}
 
-		MMThreadGuard myLock(hub->GetLock());
-
-		int ret = hub->SendReadRequest(g_offsetaddressPWM+channel);
-		if (ret != DEVICE_OK)
-			return ret;
-
-		long answer;
-		ret = ReadFromPort(answer);
+		int ret = RefreshFromPort();
 		if (ret != DEVICE_OK)
 			return ret;
 
-		pProp->Set(answer);
-		state_[channel]=answer;
+		pProp->Set(state_[channel]);
 	}
-	else if (pAct == MM::AfterSet)
-	{
-		long pos;
-		pProp->Get(pos);
+	return DEVICE_OK;
+}
 
-		if(pos<0 || pos>255){
-			pos = 0;
+int MojoInput::OnSampler(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(samplerRunning_ ? "On" : "Off");
+	} else if (pAct == MM::AfterSet){
+		std::string sampler;
+		pProp->Get(sampler);
+		if (sampler == "On"){
+			return StartSampler();
 		}
+		StopSampler();
 
-		int ret = WriteToPort(g_offsetaddressPWM+channel,pos); 
-		if (ret != DEVICE_OK)
-			return ret;
-
-		state_[channel] = pos;
+		// nothing left to record
+		std::lock_guard<std::mutex> guard(recorderMutex_);
+		recorder_.Close();
 	}
-
 	return DEVICE_OK;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////
-//////
-MojoInput::MojoInput() :
-initialized_ (false)
+int MojoInput::OnSamplerRate(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	InitializeDefaultErrorMessages();
-
-	// Custom error messages
-	SetErrorText(ERR_NO_PORT_SET, "Hub Device not found. The Mojo Hub device is needed to create this device");
-	SetErrorText(ERR_COMMAND_UNKNOWN, "An unknown command was sent to the Mojo.");
-
-	// Description
-	int ret = CreateProperty(MM::g_Keyword_Description, "Mojo AnalogInput", MM::String, true);
-	assert(DEVICE_OK == ret);
-
-	// Name
-	ret = CreateProperty(MM::g_Keyword_Name, g_DeviceNameMojoInput, MM::String, true);
-	assert(DEVICE_OK == ret);
-
-	// Number of Analog input channels
-	CPropertyAction* pAct = new CPropertyAction(this, &MojoInput::OnNumberOfChannels);
-	CreateProperty("Number of channels", "3", MM::Integer, false, pAct, true);
-	SetPropertyLimits("Number of channels", 1, g_maxanaloginput);
+	if (pAct == MM::BeforeGet){
+		pProp->Set(samplerRate_.load());
+	} else if (pAct == MM::AfterSet){
+		double rate;
+		pProp->Get(rate);
+		if (rate > 0){
+			samplerRate_ = rate;
+		}
+	}
+	return DEVICE_OK;
 }
 
-MojoInput::~MojoInput()
+int MojoInput::OnSamplerAchievedRate(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	Shutdown();
+	if (pAct == MM::BeforeGet){
+		pProp->Set(achievedRate_.load());
+	}
+	return DEVICE_OK;
 }
 
-void MojoInput::GetName(char* name) const
+int MojoInput::OnSamplerDropped(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	CDeviceUtils::CopyLimitedString(name, g_DeviceNameMojoInput);
+	if (pAct == MM::BeforeGet){
+		pProp->Set(droppedSamples_.load());
+	}
+	return DEVICE_OK;
 }
 
-bool MojoInput::Busy()
+int MojoInput::OnSamplerTimestamp(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	return false;
+	if (pAct == MM::BeforeGet){
+		long values[MojoSampleRing::maxChannels];
+		MM::MMTime time;
+		if (samples_.Latest(values, GetNumberOfChannels(), time)){
+			pProp->Set(time.getMsec());
+		}
+	}
+	return DEVICE_OK;
 }
 
-int MojoInput::Initialize()
+int MojoInput::OnRecording(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	// Parent ID display	
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
+	if (pAct == MM::BeforeGet){
+		std::lock_guard<std::mutex> guard(recorderMutex_);
+		pProp->Set(recorder_.IsOpen() ? "On" : "Off");
+	} else if (pAct == MM::AfterSet){
+		std::string recording;
+		pProp->Get(recording);
+
+		std::lock_guard<std::mutex> guard(recorderMutex_);
+		if (recording == "On"){
+			if (recorder_.IsOpen())
+				return DEVICE_OK;
+
+			int ret = recorder_.Open(recordingFile_, recordingChannels_, recordingDecimation_, GetCurrentMMTime());
+			if (ret != DEVICE_OK)
+				return ret;
+
+			// samples come from the background sampler
+			ret = StartSampler();
+			if (ret != DEVICE_OK){
+				recorder_.Close();
+				return ret;
+			}
+		} else {
+			recorder_.Close();
+		}
 	}
-	char hubLabel[MM::MaxStrLength];
-	hub->GetLabel(hubLabel);
-	SetParentID(hubLabel);
-	CreateHubIDProperty();
-
-	// State
-	// -----
-
-	// Allocate memory for inputs
-	state_ = new long [GetNumberOfChannels()];
-
-	CPropertyActionEx *pExAct;
-	int nRet;
-
-	for(unsigned int i=0;i<GetNumberOfChannels();i++){
-		state_[i] = 0;
-
-		std::stringstream sstm;
-		sstm << "AnalogInput" << i;
+	return DEVICE_OK;
+}
 
-		pExAct = new CPropertyActionEx (this, &MojoInput::OnAnalogInput,i);
-		nRet = CreateProperty(sstm.str().c_str(), "0", MM::Integer, true, pExAct);
-		if (nRet != DEVICE_OK)
-			return nRet;
+int MojoInput::OnRecordingFile(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(recordingFile_.c_str());
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(recordingFile_);
 	}
-
-	nRet = UpdateStatus();
-	if (nRet != DEVICE_OK)
-		return nRet;
-
-	initialized_ = true;
-
 	return DEVICE_OK;
 }
 
-int MojoInput::Shutdown()
+int MojoInput::OnRecordingChannels(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	initialized_ = false;
+	if (pAct == MM::BeforeGet){
+		pProp->Set(recordingChannels_);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(recordingChannels_);
+	}
 	return DEVICE_OK;
 }
 
-int MojoInput::WriteToPort(long address)
+int MojoInput::OnRecordingDecimation(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
+	if (pAct == MM::BeforeGet){
+		pProp->Set(recordingDecimation_);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(recordingDecimation_);
 	}
+	return DEVICE_OK;
+}
 
-	MMThreadGuard myLock(hub->GetLock());
-
-	hub->PurgeComPortH();
-
-	int ret = hub->SendReadRequest(address);
-	if (ret != DEVICE_OK)
-		return ret;
-
+int MojoInput::OnRecordedSamples(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		std::lock_guard<std::mutex> guard(recorderMutex_);
+		pProp->Set(static_cast<long>(recorder_.GetRecordCount()));
+	}
 	return DEVICE_OK;
 }
 
-int MojoInput::ReadFromPort(long& answer)
+int MojoInput::OnStream(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
-	MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-	if (!hub) {
-		return ERR_NO_PORT_SET;
+	if (pAct == MM::BeforeGet){
+		pProp->Set(streamRunning_ ? "On" : "Off");
+	} else if (pAct == MM::AfterSet){
+		std::string stream;
+		pProp->Get(stream);
+		if (stream == "On")
+			return StartStream(static_cast<unsigned long>(streamChannels_), streamDecimation_);
+		StopStream();
 	}
-	int ret = hub->ReadAnswer(answer);
-	if (ret != DEVICE_OK)
-		return ret;
+	return DEVICE_OK;
+}
 
+int MojoInput::OnStreamChannels(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(streamChannels_);
+	} else if (pAct == MM::AfterSet){
+		pProp->Get(streamChannels_);
+	}
 	return DEVICE_OK;
 }
 
-///////////////////////////////////////
-/////////// Action handlers
-int MojoInput::OnNumberOfChannels(MM::PropertyBase* pProp, MM::ActionType pAct)
+int MojoInput::OnStreamDecimation(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
 	if (pAct == MM::BeforeGet){
-		pProp->Set(numChannels_);
+		pProp->Set(streamDecimation_);
 	} else if (pAct == MM::AfterSet){
-		pProp->Get(numChannels_);
+		pProp->Get(streamDecimation_);
 	}
 	return DEVICE_OK;
 }
 
-int MojoInput::OnAnalogInput(MM::PropertyBase* pProp, MM::ActionType pAct, long channel)
+int MojoInput::OnStreamCounter(MM::PropertyBase* pProp, MM::ActionType pAct, long index)
 {
 	if (pAct == MM::BeforeGet){
-		MojoHub* hub = static_cast<MojoHub*>(GetParentHub());
-		if (!hub){
-			return ERR_NO_PORT_SET;
+		const unsigned long long counters[] = {streamReceived_, streamLost_, streamDropped_, stream_.Size()};
+		pProp->Set(static_cast<long>(counters[index]));
+	}
+	return DEVICE_OK;
+}
+
+int MojoInput::OnStreamRate(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+	if (pAct == MM::BeforeGet){
+		pProp->Set(streamRate_.load());
+	}
+	return DEVICE_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//////
+MojoSampleRing::MojoSampleRing()
+{
+	Reset();
+}
+
+void MojoSampleRing::Reset()
+{
+	for(int i=0;i<size_;i++){
+		slots_[i].sequence = 0;
+		slots_[i].timeUs = 0;
+		for(int j=0;j<maxChannels;j++){
+			slots_[i].values[j] = 0;
+		}
+	}
+	published_ = 0;
+}
+
+void MojoSampleRing::Publish(const long* values, long count, const MM::MMTime& time)
+{
+	const unsigned long n = published_.load(std::memory_order_relaxed);
+	Slot& slot = slots_[n % size_];
+
+	// odd sequence while the slot is being written
+	slot.sequence.store(2*n + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for(long j=0;j<count && j<maxChannels;j++){
+		slot.values[j].store(values[j], std::memory_order_relaxed);
+	}
+	slot.timeUs.store(static_cast<long long>(time.getUsec()), std::memory_order_relaxed);
+
+	slot.sequence.store(2*n + 2, std::memory_order_release);
+	published_.store(n + 1, std::memory_order_release);
+}
+
+bool MojoSampleRing::Latest(long* values, long count, MM::MMTime& time) const
+{
+	for(;;){
+		const unsigned long n = published_.load(std::memory_order_acquire);
+		if (n == 0)
+			return false;
+
+		const Slot& slot = slots_[(n - 1) % size_];
+		const unsigned long before = slot.sequence.load(std::memory_order_acquire);
+
+		for(long j=0;j<count && j<maxChannels;j++){
+			values[j] = slot.values[j].load(std::memory_order_relaxed);
 		}
+		const long long us = slot.timeUs.load(std::memory_order_relaxed);
 
-		MMThreadGuard myLock(hub->GetLock());
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (before == 2*n && slot.sequence.load(std::memory_order_relaxed) == before){
+			time = MM::MMTime(static_cast<double>(us));
+			return true;
+		}
+		// the writer lapped the ring during the copy, try again with the newest slot
+	}
+}
 
-		int ret = hub->SendReadRequest(g_offsetaddressAnalogInput+channel);
-		if (ret != DEVICE_OK)
-			return ret;
+///////////////////////////////////////////////////////////////////////////////////////////
+//////
+MojoStreamRing::MojoStreamRing(size_t capacity) :
+	samples_(capacity)
+{
+	Reset();
+}
 
-		long answer;
-		ret = ReadFromPort(answer);
-		if (ret != DEVICE_OK)
-			return ret;
+void MojoStreamRing::Reset()
+{
+	pushed_ = 0;
+	popped_ = 0;
+}
 
+bool MojoStreamRing::Push(const MojoStreamSample& sample)
+{
+	// single writer: the slot is filled before it is published
+	const unsigned long long n = pushed_.load(std::memory_order_relaxed);
+	if (n - popped_.load(std::memory_order_acquire) >= samples_.size())
+		return false;
+
+	samples_[n % samples_.size()] = sample;
+	pushed_.store(n + 1, std::memory_order_release);
+	return true;
+}
+
+size_t MojoStreamRing::Pop(MojoStreamSample* samples, size_t max)
+{
+	// single reader: the slots are released once copied
+	const unsigned long long first = popped_.load(std::memory_order_relaxed);
+	const size_t n = static_cast<size_t>(std::min<unsigned long long>(max, pushed_.load(std::memory_order_acquire) - first));
 
-		pProp->Set(answer);
-		state_[channel]=answer;
+	for(size_t i=0;i<n;i++){
+		samples[i] = samples_[(first + i) % samples_.size()];
 	}
-	return DEVICE_OK;
+	popped_.store(first + n, std::memory_order_release);
+	return n;
+}
+
+size_t MojoStreamRing::Size() const
+{
+	return static_cast<size_t>(pushed_.load(std::memory_order_acquire) - popped_.load(std::memory_order_acquire));
 }
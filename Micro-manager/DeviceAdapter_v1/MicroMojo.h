@@ -16,6 +16,21 @@
 
 #include "../../MMDevice/MMDevice.h"
 #include "../../MMDevice/DeviceBase.h"
+#include "MojoMetrics.h"
+#include "MojoRecorder.h"
+#include "MojoSerialPort.h"
+#include "MojoSimulator.h"
+#include "MojoTcp.h"
+#include "MojoTransport.h"
+#include "MojoTty.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
 
 //////////////////////////////////////////////////////////////////////////////
 // Error codes
@@ -24,9 +39,150 @@
 #define ERR_PORT_OPEN_FAILED 102
 #define ERR_NO_PORT_SET 103
 #define ERR_VERSION_MISMATCH 104
+#define ERR_RECORDING_FAILED 105
+#define ERR_METRICS_FILE 106
+#define ERR_CHANNELS_UNAVAILABLE 107
+#define ERR_NO_CAMERA_TRIGGER 108
+#define ERR_SEQUENCE_INVALID 109
+#define ERR_PRESET_UNKNOWN 110
+#define ERR_PRESET_FILE 111
+#define ERR_FRAME_PLAN 112
+#define ERR_NO_FRAME_COUNTER 113
+#define ERR_NO_TIMESTAMPS 114
+#define ERR_NO_SAMPLE_STREAM 115
+#define ERR_FRAME_RATE_RANGE 116
 #define ERR_COMMAND_UNKNOWN 38730
 
 
+//////////////////////////////////////////////////////////////////////////////
+// Register map of a firmware version (see mojo_top.luc), addresses of the
+// blocks absent from a version are -1
+//
+struct MojoRegisterMap
+{
+   long version;
+   long versionAddress;
+   long idAddress;
+   long errorCode;         // answer to the read of an unknown address
+
+   int maxLasers;
+   int maxTTL;
+   int maxServos;
+   int maxPWM;
+   int maxAnalogInput;
+   long maxDuration;
+
+   long laserMode;
+   long laserDuration;
+   long laserSequence;
+   long ttl;
+   long servo;
+   long pwm;
+   long analogInput;
+
+   // camera_trigger block
+   long activeTrigger;
+   long startTrigger;
+   long cameraPulse;
+   long cameraReadout;
+   long cameraExposure;
+   long laserDelay;
+
+   // per-frame TTL patterns (bit 16 enables the pattern of a channel)
+   long ttlSequence;
+
+   // frame-counted bursts of the camera trigger: frames of a burst (0 to run
+   // until stopped) and frames of the burst not completed (read-only)
+   long frameCount;
+   long framesRemaining;
+
+   // rising edges of the camera signal counted on 32 bits (a write clears
+   // the counter and the timestamps, and restarts the sequences as
+   // sequenceRestart), timestamps queued, and the queue of their timestamps
+   // in us (each read removes one)
+   long frameCounter;
+   long timestampLevel;
+   long timestamp;
+
+   // analog sample stream: channel mask (a write clears the samples), scans
+   // skipped after each scan streamed, samples queued, and the queue of the
+   // samples, {counter[19], channel[3], value[10]} (each read removes one)
+   long sampleChannels;
+   long sampleDivider;
+   long sampleLevel;
+   long sample;
+
+   // write-only strobe (reads 0): the next camera frame plays the first step
+   // of the laser and TTL sequences
+   long sequenceRestart;
+
+   // protocols supported besides the legacy requests (bit 0: framed requests)
+   long protocol;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Transaction queued on the hub I/O thread: a write frame, or the read of
+// <count> consecutive registers (or of a list of addresses) when the frame
+// is empty. A committed batch is a single frame with the owners of all its
+// writes, attributed to the hub in the lock metrics if they are devices of
+// different types. The synchronous reads reuse pooled transactions, their
+// result is signaled by <finished> instead of the promise.
+//
+struct MojoTransaction
+{
+   MojoTransaction(const MM::Device* o) : owners(1, o), client(MojoMetrics::ClientHub), posted(false), pooled(false), finished(false), result(DEVICE_OK), address(0), count(0), values(0) {}
+
+   std::vector<const MM::Device*> owners;
+   MojoMetrics::Client client;
+   bool posted;                  // nobody waits for <done>, errors go to the owners
+   bool pooled;
+   bool finished;
+   int result;
+   std::vector<unsigned char> frame;
+   std::vector<long> addresses;  // read of arbitrary registers instead of <count> consecutive ones
+   long address;
+   long count;
+   long* values;
+   std::promise<int> done;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Lock of the byte exchange with a board, held for the scope of a block. The
+// time spent waiting for the lock and holding it is reported to the metrics.
+//
+class MojoIOGuard
+{
+public:
+   MojoIOGuard(MMThreadLock& lock, MojoMetrics& metrics, MojoMetrics::Client client) :
+      lock_(lock), metrics_(metrics), client_(client)
+   {
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      lock_.Lock();
+      locked_ = std::chrono::steady_clock::now();
+      waitUs_ = std::chrono::duration<double, std::micro>(locked_ - start).count();
+   }
+
+   ~MojoIOGuard()
+   {
+      const double holdUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - locked_).count();
+      lock_.Unlock();
+      metrics_.RecordLock(client_, waitUs_, holdUs);
+   }
+
+private:
+   MojoIOGuard(const MojoIOGuard&);
+   MojoIOGuard& operator=(const MojoIOGuard&);
+
+   MMThreadLock& lock_;
+   MojoMetrics& metrics_;
+   MojoMetrics::Client client_;
+   std::chrono::steady_clock::time_point locked_;
+   double waitUs_;
+};
+
+
 class MojoHub : public HubBase<MojoHub>  
 {
 public:
@@ -43,25 +199,270 @@ public:
 
    // property handlers
    int OnPort(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnTransport(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnTtyDevice(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnBridgeHost(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnBridgePort(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnSimulatorLatency(MM::PropertyBase* pPropt, MM::ActionType eAct, long index);
    int OnVersion(MM::PropertyBase* pPropt, MM::ActionType eAct);
-
-   int PurgeComPortH() {return PurgeComPort(port_.c_str());}
+   int OnBoardID(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnResync(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnPresetName(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnPreset(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnPresetFile(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnPresetFileAction(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnStartupPreset(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnPresets(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnMetricsCounter(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnMetricsLatency(MM::PropertyBase* pPropt, MM::ActionType eAct, long index);
+   int OnMetricsLock(MM::PropertyBase* pPropt, MM::ActionType eAct, long index);
+   int OnMetricsFile(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnMetricsAction(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnBatchWrites(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnNumberOfBoards(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnBoardTransport(MM::PropertyBase* pPropt, MM::ActionType eAct, long board);
+   int OnBoardPort(MM::PropertyBase* pPropt, MM::ActionType eAct, long board);
+   int OnProtocol(MM::PropertyBase* pPropt, MM::ActionType eAct);
+
+   int PurgeComPortH() {return transport_ ? transport_->Purge() : DEVICE_NOT_CONNECTED;}
    int SendWriteRequest(long address, long value);
    int SendReadRequest(long address);
    int ReadAnswer(long& answer);
-   int WriteToComPortH(const unsigned char* command, unsigned len) {return WriteToComPort(port_.c_str(), command, len);}
+   int ReadBlock(long address, long count, long* values);
+   int ReadRegisters(long address, long count, long* values);
+   int ReadRegisters(const std::vector<long>& addresses, std::vector<long>& values);
+   int ReadScattered(const std::vector<long>& addresses, std::vector<long>& values, std::vector<bool>& unknown);
+   int ReadQueue(long address, long count, long* values);
+   int ResyncRegisters();
+   void InvalidateRegisters();
+   bool IsVolatileRegister(long address) const;
+   const MojoRegisterMap& GetRegisterMap() const {return *map_;}
+   int WriteBlock(long address, const long* values, long count);
+   int WriteFrame(const std::vector<unsigned char>& frame, const std::vector<const MM::Device*>& owners);
+   static void AppendReadRequest(std::vector<unsigned char>& frame, long address, long count, bool increment = true);
+   static void AppendWriteFrame(std::vector<unsigned char>& frame, long address, const long* values, long count);
+   void AppendSequenceRestart(std::vector<unsigned char>& frame) const;
+
+   // asynchronous transactions, executed in order by the I/O thread (by the
+   // I/O thread of each board with several boards). The errors of the posted
+   // writes are returned by the next PostWrite, PostFrame or SendFrame of
+   // their owner.
+   int PostWrite(const MM::Device* owner, long address, long value);
+   int PostFrame(const MM::Device* owner, const std::vector<unsigned char>& frame);
+   int SendFrame(const MM::Device* owner, const std::vector<unsigned char>& frame);
+   int SendRead(const MM::Device* owner, long address, long count, long* values);
+   std::future<int> PostRead(const MM::Device* owner, long address, long count, long* values);
+   std::future<int> PostRead(const MM::Device* owner, const std::vector<long>& addresses, long* values);
+   bool IsBusy(const MM::Device* owner);
+
+   // Presets: images of the registers of the laser modes, durations and
+   // sequences, TTLs, servos and PWMs. Applying a preset only writes the
+   // registers that differ from the shadow registers, in bursts.
+   int StorePreset(const std::string& name);
+   int ApplyPreset(const std::string& name);
+   int DeletePreset(const std::string& name);
+   int SavePresets(const std::string& path) const;
+   int LoadPresets(const std::string& path);
+
+   // Lasers held OFF by a closed laser shutter. The mode written to a held
+   // laser is kept by the hub, the shutter applies it when it opens.
+   void HoldLaser(long laser, long mode);
+   void ReleaseLaser(long laser);
+   bool GetHeldLaser(long laser, long& mode);
+   bool UpdateHeldLaser(long laser, long mode);
+
+   // write batches: the frames posted by any device between BeginBatch and
+   // CommitBatch are held and sent in a single write to the port (batches nest),
+   // the boards of a multi-board hub send their part concurrently
+   void BeginBatch();
+   int CommitBatch();
+   // all I/O goes through the transport selected by the Transport property
+   int WriteToComPortH(const unsigned char* command, unsigned len) {
+      return transport_ ? transport_->Write(command, len) : DEVICE_NOT_CONNECTED;
+   }
    int ReadFromComPortH(unsigned char* answer, unsigned maxLen, unsigned long& bytesRead) {
-      return ReadFromComPort(port_.c_str(), answer, maxLen, bytesRead);
+      bytesRead = 0;
+      return transport_ ? transport_->Read(answer, maxLen, bytesRead) : DEVICE_NOT_CONNECTED;
    }
-   static MMThreadLock& GetLock() {return lock_;}
+
+   // replaces the transport selected by the Transport property (of the first
+   // board with several boards), must be set before Initialize (not owned)
+   void SetTransport(MojoTransport* transport) {transport_ = transport;}
 
 private:
+   // Registers <address> to <address>+<count>-1 of the aggregated register
+   // map, held by board <board> from its register <reg>
+   struct Segment
+   {
+      long address;
+      long count;
+      size_t board;
+      long reg;
+   };
+
+   // Framed request sent to the board and not answered yet, and answer to a
+   // framed read received while waiting for another one. The write requests
+   // are kept with the owners of their frame until acknowledged.
+   struct FramedRequest
+   {
+      unsigned char seq;
+      bool write;
+      std::vector<unsigned char> request;
+      std::vector<const MM::Device*> owners;
+   };
+
+   struct FramedAnswer
+   {
+      std::vector<long> values;
+      bool unknown;
+   };
+
    int GetControllerVersion(long&);
+   int ProbeVersion(const std::string& port, long& version);
+   int CreateTransport(const std::string& name, const std::string& address, MojoTransport*& transport);
+   std::string GetTransportAddress() const;
+   int ConnectBoard();
+   int ConnectBoards();
+   void AddAggregatedBlock(long MojoRegisterMap::* base, int MojoRegisterMap::* count, long& next);
+   void AddAggregatedRegister(long MojoRegisterMap::* address, long& next);
+   bool Translate(long address, size_t& board, long& reg) const;
+   bool SplitFrame(const std::vector<unsigned char>& frame, std::vector<std::vector<unsigned char> >& frames) const;
+   int WriteBoards(const MM::Device* owner, const std::vector<unsigned char>& frame, bool wait);
+   int ReadBoards(const MM::Device* owner, const std::vector<long>& addresses, std::vector<long>& values, bool cached);
+   void ReadShadow(const std::vector<long>& addresses, std::vector<long>& values, std::vector<long>& missing, std::vector<size_t>& slots);
+   std::future<int> QueueFrame(const MM::Device* owner, const std::vector<unsigned char>& frame);
+   void GetPresetRegisters(std::vector<long>& addresses) const;
+   int SendBurstReadRequest(long address, long count);
+   int ReadAnswers(long* answers, long count);
+   int ReadBytes(unsigned char* data, unsigned long count);
+   int NegotiateProtocol();
+   void AppendFramedRequests(std::vector<unsigned char>& framed, const std::vector<unsigned char>& frame, std::vector<unsigned char>& seqs, const std::vector<const MM::Device*>& owners);
+   int CollectAnswers(int seq, size_t keep, long* values, bool& unknown);
+   void DropFramedRequests();
+   void CollectAcknowledgements();
+   void UpdateShadow(long address, const long* values, long count);
+   void UpdateShadow(const std::vector<unsigned char>& frame);
+   void ExpectWrites(const std::vector<unsigned char>& frame);
+   void AcknowledgeWrites(const FramedRequest& request, bool ok);
+   int PostFrame(MojoTransaction* t);
+   void SetError(const MM::Device* owner, int error);
+   int TakeError(const MM::Device* owner);
+   void Enqueue(MojoTransaction* t);
+   void Push(MojoTransaction* t);
+   MojoTransaction* TakeBatch();
+   void Execute(MojoTransaction* t);
+   void Finish(MojoTransaction* t);
+   void StartIOThread();
+   void StopIOThread();
+   void IOThread();
+   bool IsErrorCode(long value) const;
+   MojoMetrics::Range GetRegisterRange(long address) const;
+   static double ElapsedUs(const std::chrono::steady_clock::time_point& start);
+   static MojoMetrics::Client GetClient(const MM::Device* owner);
    std::string port_;
    bool initialized_;
    bool portAvailable_;
+   std::string transportName_;
+   MojoTransport* transport_;
+   MojoTransport* ownedTransport_;
+   double simulatorLatencyUs_[2];
+   std::string ttyDevice_;
+   std::string bridgeHost_;
+   long bridgePort_;
+   std::vector<unsigned char> requestBuffer_;   // read requests, reused under lock_
    long version_;
-   static MMThreadLock lock_;
+   long boardID_;
+   const MojoRegisterMap* map_;
+   MojoRegisterMap registerMap_;
+   std::vector<long> shadow_;
+   std::vector<bool> shadowValid_;
+   std::vector<int> shadowPending_;   // framed writes not acknowledged yet
+   MMThreadLock shadowLock_;
+   std::thread ioThread_;
+   std::mutex queueMutex_;
+   std::condition_variable queueCond_;
+   std::deque<MojoTransaction*> queue_;
+   std::vector<MojoTransaction*> readPool_;   // transactions of the synchronous reads
+   std::condition_variable readCond_;
+   std::map<const MM::Device*, int> pendingCommands_;
+   std::map<const MM::Device*, int> ioErrors_;   // first error of the posted writes of each owner
+   bool ioRunning_;
+   bool stopIO_;
+   int batchDepth_;
+   bool batchProperty_;
+   std::vector<unsigned char> batchFrame_;
+   std::vector<const MM::Device*> batchOwners_;
+   MojoMetrics::Client batchClient_;
+   MojoMetrics metrics_;
+   MojoMetrics* ioMetrics_;   // metrics_ of the hub that owns the board
+   std::string metricsFile_;
+   MMThreadLock lock_;        // byte exchange with the board of this hub
+   MojoMetrics::Client ioClient_;   // device type of the transaction in progress
+
+   // Framed protocol (reg_frame_interface.luc), requested by the Protocol
+   // property and used if the firmware supports it. Writes are acknowledged
+   // by the board, their acknowledgements are collected by the following
+   // reads or when the I/O thread is idle. A refused write is reported to the
+   // owners of its frame, and the shadow registers only take the values of
+   // acknowledged writes. Members used under lock_.
+   std::string protocolName_;
+   bool framed_;
+   unsigned char sequence_;          // sequence number of the next request
+   std::deque<FramedRequest> inFlight_;
+   std::map<unsigned char, FramedAnswer> early_;
+   std::vector<unsigned char> framedBuffer_;
+
+   // Boards of a multi-board hub, each with its transport, shadow registers
+   // and I/O thread. The devices see the channels of all the boards in a
+   // single register map, registerMap_, translated by segments_.
+   long numBoards_;
+   std::vector<std::string> boardTransport_;
+   std::vector<std::string> boardPort_;
+   std::vector<MojoHub*> boards_;
+   std::vector<Segment> segments_;
+
+   // register images, in the order of GetPresetRegisters
+   std::map<std::string, std::vector<long> > presets_;
+   std::string presetName_;
+   std::string presetFile_;
+   std::string startupPreset_;
+
+   std::map<long, long> heldLasers_;   // laser, mode applied when the shutter opens
+   std::mutex heldMutex_;
+
+   // port of the last board found in this process, offered for reconnection
+   static std::string lastGoodPort_;
+   static std::mutex lastGoodPortMutex_;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Write batch on the scope of a block:
+//
+//    {
+//       MojoBatch batch(hub);
+//       ... writes of any Mojo device ...
+//    }  // sent in a single write to the port
+//
+class MojoBatch
+{
+public:
+   MojoBatch(MojoHub* hub) : hub_(hub) {if (hub_) hub_->BeginBatch();}
+   ~MojoBatch() {Commit();}
+
+   // sends the batch now, returns the error of the previous asynchronous writes
+   int Commit()
+   {
+      MojoHub* hub = hub_;
+      hub_ = 0;
+      return hub ? hub->CommitBatch() : DEVICE_OK;
+   }
+
+private:
+   MojoBatch(const MojoBatch&);
+   MojoBatch& operator=(const MojoBatch&);
+
+   MojoHub* hub_;
 };
 
 
@@ -79,9 +480,10 @@ public:
    int Shutdown();
   
    void GetName(char* pszName) const;
-   bool Busy() {return busy_;}
+   bool Busy();
    
    unsigned long GetNumberOfLasers()const {return numlasers_;}
+   int ApplyAll();
 
    // action interface
    // ----------------
@@ -89,18 +491,80 @@ public:
    int OnDuration(MM::PropertyBase* pProp, MM::ActionType eAct, long laser);
    int OnSequence(MM::PropertyBase* pProp, MM::ActionType eAct, long laser);
    int OnNumberOfLasers(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDeferredWrites(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnApplyAll(MM::PropertyBase* pProp, MM::ActionType eAct);
 
 private:
 	
    int WriteToPort(long address, long value);
-   int ReadFromPort(long& answer);
+   int RefreshFromPort();
+   int WriteModeAndSequence(long laser, long mode, long sequence, bool restart);
+   long GateMode(long laser, long mode);
 
    bool initialized_;
    long numlasers_;
+   long modeAddress_;
+   long durationAddress_;
+   long sequenceAddress_;
+   long restartAddress_;
    long *mode_;
    long *duration_;
    long *sequence_;
-   bool busy_;
+   bool deferred_;
+   bool pending_;
+
+   // property sequences of the laser modes, compiled to a mode and a pattern,
+   // and the host values restored when the sequence stops
+   std::vector<long> sequenceMode_;
+   std::vector<long> sequencePattern_;
+   std::vector<long> savedMode_;
+   std::vector<long> savedSequence_;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Shutter on the lasers of the laser trigger: closing sets the selected
+// lasers to OFF, opening sets them to their open mode, the mode they had
+// when the shutter closed or the one set by OpenMode<laser>. While the
+// shutter is closed, the modes written by the laser trigger become the open
+// modes and the lasers stay OFF. All the lasers switch in a single transfer.
+//
+class MojoLaserShutter : public CShutterBase<MojoLaserShutter>
+{
+public:
+   MojoLaserShutter();
+   ~MojoLaserShutter();
+
+   // MMDevice API
+   // ------------
+   int Initialize();
+   int Shutdown();
+
+   void GetName(char* pszName) const;
+   bool Busy();
+
+   // Shutter API
+   int SetOpen(bool open = true);
+   int GetOpen(bool& open);
+   int Fire(double deltaT);
+
+   unsigned long GetNumberOfLasers()const {return numlasers_;}
+
+   // action interface
+   // ----------------
+   int OnNumberOfLasers(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSelected(MM::PropertyBase* pProp, MM::ActionType eAct, long laser);
+   int OnOpenMode(MM::PropertyBase* pProp, MM::ActionType eAct, long laser);
+   int OnState(MM::PropertyBase* pProp, MM::ActionType eAct);
+
+private:
+   int ReadModes(std::vector<long>& modes);
+
+   bool initialized_;
+   long numlasers_;
+   long modeAddress_;
+   std::vector<long> selected_;
+   std::vector<long> openMode_;   // modes restored when the shutter opens
+   bool openDark_;                // opened with no laser to switch on
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -118,7 +582,7 @@ public:
    int Shutdown();
   
    void GetName(char* pszName) const;
-   bool Busy() {return busy_;}
+   bool Busy();
    
    unsigned long GetNumberOfServos()const {return numServos_;}
 
@@ -129,12 +593,12 @@ public:
 
 private:
    int WriteToPort(long address, long value);
-   int ReadFromPort(long& answer);
+   int RefreshFromPort();
 
    long *position_;
    bool initialized_;
    long numServos_;
-   bool busy_;
+   long address_;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -152,7 +616,7 @@ public:
    int Shutdown();
   
    void GetName(char* pszName) const;
-   bool Busy() {return busy_;}
+   bool Busy();
    
    unsigned long GetNumberOfChannels()const {return numChannels_;}
 
@@ -163,12 +627,16 @@ public:
 
 private:
    int WriteToPort(long channel, long state);
-   int ReadFromPort(long& answer);
+   int RefreshFromPort();
+   int WritePattern(long channel, bool enable);
 
    long numChannels_;
    long *state_;
    bool initialized_;
-   bool busy_;
+   long address_;
+   long sequenceAddress_;
+   long restartAddress_;
+   std::vector<long> pattern_;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -186,7 +654,7 @@ public:
    int Shutdown();
   
    void GetName(char* pszName) const;
-   bool Busy() {return busy_;}
+   bool Busy();
    
    unsigned long GetNumberOfChannels()const {return numChannels_;}
 
@@ -197,12 +665,195 @@ public:
 
 private:
    int WriteToPort(long channel, long value);
-   int ReadFromPort(long& answer);
+   int RefreshFromPort();
    
    bool initialized_;
    long *state_;
    long numChannels_;
-   bool busy_;
+   long address_;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Camera trigger registers planned for a frame rate (durations in us), with
+// the frame rate they achieve and their quantization errors
+//
+struct MojoFramePlan
+{
+   long pulse;
+   long readout;
+   long exposure;
+   long delay;
+
+   double frameRate;
+   double minFrameRate;      // with the longest readout register
+   double maxFrameRate;      // with the shortest readout
+   double frameRateError;    // achieved minus requested frame rate
+   double exposureError;     // programmed minus requested exposure (us)
+};
+
+//
+// Timing of the camera frames from the timestamps of the board: intervals
+// close to the expected period are single frames, longer ones miss the
+// frames that fit in them
+//
+struct MojoFrameTiming
+{
+   long frames;              // counted by the board
+   long timestamps;          // received
+   long lostTimestamps;      // counted while the queue of the board was full
+   long missedFrames;
+   double periodUs;          // expected interval
+   double meanIntervalUs;    // of the single-frame intervals
+   double jitterUs;          // standard deviation of the single-frame intervals
+   double maxJitterUs;       // largest deviation from the period
+};
+
+//
+// Hardware camera trigger of the v3 firmware: the board fires the camera and
+// drives the lasers from the exposure signal (camera_trigger.luc). Durations
+// are in us.
+//
+class MojoCameraTrigger : public CGenericBase<MojoCameraTrigger>
+{
+public:
+   MojoCameraTrigger();
+   ~MojoCameraTrigger();
+
+   int Initialize();
+   int Shutdown();
+   void GetName(char* pszName) const;
+   bool Busy();
+
+   int OnActiveTrigger(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnStart(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDuration(MM::PropertyBase* pProp, MM::ActionType eAct, long index);
+   int OnPlannerInput(MM::PropertyBase* pProp, MM::ActionType eAct, long index);
+   int OnPlanner(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPlan(MM::PropertyBase* pProp, MM::ActionType eAct, long index);
+   int OnBurstFrames(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnBurst(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFramesRemaining(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFrameCounter(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFrameTimingAction(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFrameTiming(MM::PropertyBase* pProp, MM::ActionType eAct, long index);
+
+   // Frame-counted bursts: the board starts the trigger and stops it by
+   // itself after <frames> frames (0 runs until stopped). Busy() reports
+   // until the last frame is over.
+   int StartBurst(long frames);
+   int StopBurst();
+   int GetFramesRemaining(long& frames);
+
+   // Frame-rate planner: the fire pulse, readout, exposure and laser delay
+   // registers for a frame rate, an exposure, the shortest readout of the
+   // camera and a laser delay. The period of the trigger is the sum of the
+   // delay, exposure and readout registers, all in whole microseconds. A
+   // frame rate out of the range of the plan is refused, the range is set.
+   static int PlanFrameRate(double frameRate, double exposureUs, double readoutUs, double delayUs, MojoFramePlan& plan);
+   // writes the four registers in a single burst, if their period is the
+   // requested one to the microsecond
+   int ApplyFramePlan(const MojoFramePlan& plan);
+
+   // Frame timestamps: the board timestamps the rising edges of the camera
+   // signal (the exposure signal with the active trigger) in a queue that
+   // DrainTimestamps empties in bursts, the timing covers all the timestamps
+   // drained since ResetFrameTiming. The queue of the board holds a few
+   // hundred frames, it must be drained at least twice a second at 1 kHz.
+   int ResetFrameTiming();
+   int DrainTimestamps(std::vector<unsigned long>& timestamps);
+   int GetFrameTiming(MojoFrameTiming& timing);
+
+private:
+   enum Register { ActiveTrigger, StartTrigger, CameraPulse, CameraReadout, CameraExposure, LaserDelay, NumRegisters };
+   enum PlannerInput { PlanFrameRateInput, PlanExposureInput, PlanReadoutInput, PlanDelayInput, NumPlannerInputs };
+
+   int WriteToPort(long index, long value);
+   int RefreshFromPort();
+   void AddTimestamps(const std::vector<unsigned long>& timestamps, double periodUs);
+
+   bool initialized_;
+   long address_[NumRegisters];
+   long state_[NumRegisters];
+   double plannerInput_[NumPlannerInputs];
+   MojoFramePlan plan_;
+   long frameCountAddress_;
+   long framesRemainingAddress_;
+   long burstFrames_;
+   bool burst_;         // a burst may be running
+   long frameCounterAddress_;
+   long timestampLevelAddress_;
+   long timestampAddress_;
+   MojoFrameTiming timing_;
+   unsigned long lastTimestamp_;
+   long singleIntervals_;
+   double intervalSum_;
+   double intervalSquares_;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Latest analog samples published by the MojoInput sampler thread. There is a
+// single writer and readers never block it: each slot of the ring carries a
+// sequence number that is odd while the slot is written, and readers retry
+// when the slot changed under them.
+//
+class MojoSampleRing
+{
+public:
+   static const int maxChannels = 8;
+
+   MojoSampleRing();
+
+   void Reset();
+   void Publish(const long* values, long count, const MM::MMTime& time);
+   bool Latest(long* values, long count, MM::MMTime& time) const;
+
+private:
+   static const int size_ = 8;
+
+   struct Slot
+   {
+      std::atomic<unsigned long> sequence;
+      std::atomic<long> values[maxChannels];
+      std::atomic<long long> timeUs;
+   };
+
+   Slot slots_[size_];
+   std::atomic<unsigned long> published_;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Samples streamed by the board, in the order of acquisition. The index
+// counts the samples of the enabled channels since the start of the stream,
+// the indices skipped were lost on the board.
+//
+struct MojoStreamSample
+{
+   unsigned long long index;
+   int channel;
+   long value;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Ring of the streamed samples between the MojoInput stream thread and the
+// readers, samples are dropped while it is full.
+//
+class MojoStreamRing
+{
+public:
+   MojoStreamRing(size_t capacity);
+
+   void Reset();
+   bool Push(const MojoStreamSample& sample);
+   size_t Pop(MojoStreamSample* samples, size_t max);
+   size_t Size() const;
+
+private:
+   std::vector<MojoStreamSample> samples_;
+   std::atomic<unsigned long long> pushed_;
+   std::atomic<unsigned long long> popped_;
 };
 
 
@@ -221,17 +872,79 @@ public:
 
    int OnAnalogInput(MM::PropertyBase* pProp, MM::ActionType eAct, long channel);
    int OnNumberOfChannels(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSampler(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSamplerRate(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSamplerAchievedRate(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSamplerDropped(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSamplerTimestamp(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnRecording(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnRecordingFile(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnRecordingChannels(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnRecordingDecimation(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnRecordedSamples(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnStream(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnStreamChannels(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnStreamDecimation(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnStreamCounter(MM::PropertyBase* pProp, MM::ActionType eAct, long index);
+   int OnStreamRate(MM::PropertyBase* pProp, MM::ActionType eAct);
    
    unsigned long GetNumberOfChannels()const {return numChannels_;}
+   bool GetLatestSamples(long* values, MM::MMTime& time) const;
+
+   // Sample stream: the board queues every sample of the enabled channels
+   // (one scan out of <decimation>), a thread drains the queue in bursts
+   // into a ring that ReadStream empties. Samples lost on the board show as
+   // gaps in the indices and in GetStreamLost, samples dropped because the
+   // ring was full in GetStreamDropped.
+   int StartStream(unsigned long channelMask, long decimation);
+   void StopStream();
+   size_t ReadStream(MojoStreamSample* samples, size_t max);
+   unsigned long long GetStreamReceived() const {return streamReceived_;}
+   unsigned long long GetStreamLost() const {return streamLost_;}
+   unsigned long long GetStreamDropped() const {return streamDropped_;}
 
 private:
-   int WriteToPort(long address);
-   int ReadFromPort(long& answer);
+   int RefreshFromPort();
+   int StartSampler();
+   void StopSampler();
+   void SamplerThread();
+   void StreamThread();
    
-   MMThreadLock lock_;
    long numChannels_;
    long *state_;
    bool initialized_;
+   long address_;
+
+   MojoHub* samplerHub_;
+   std::thread samplerThread_;
+   std::atomic<bool> samplerRunning_;
+   std::atomic<bool> stopSampler_;
+   std::atomic<double> samplerRate_;
+   std::atomic<double> achievedRate_;
+   std::atomic<long> droppedSamples_;
+   MojoSampleRing samples_;
+
+   MojoRecorder recorder_;
+   std::mutex recorderMutex_;
+   std::string recordingFile_;
+   long recordingChannels_;
+   long recordingDecimation_;
+
+   long streamChannelsAddress_;
+   long streamLevelAddress_;
+   long streamSampleAddress_;
+   MojoHub* streamHub_;
+   std::thread streamThread_;
+   std::atomic<bool> streamRunning_;
+   std::atomic<bool> stopStream_;
+   std::atomic<unsigned long long> streamReceived_;
+   std::atomic<unsigned long long> streamLost_;
+   std::atomic<unsigned long long> streamDropped_;
+   std::atomic<double> streamRate_;
+   unsigned long long streamIndex_;
+   long streamChannels_;
+   long streamDecimation_;
+   MojoStreamRing stream_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,234 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoBenchmark.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Property throughput and latency of the MicroMojo adapter
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+// Loads the MicroMojo devices in the Micro-Manager core, with the hub on
+// its simulated board, and times representative property workloads:
+//
+//    MojoBenchmark [iterations] [transaction latency (us)] [byte latency (us)]
+//
+// Each workload repeats an operation (a group of property calls) and reports
+// the property calls per second, the p50/p99 latency of an operation and the
+// bytes sent to and received from the board per operation. Setters are
+// followed by waitForDevice so that the operation includes the transaction.
+//
+
+#include "../../MMCore/MMCore.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const char* g_hub = "Hub";
+const char* g_lasers = "Lasers";
+const char* g_ttl = "TTL";
+const char* g_servos = "Servos";
+const char* g_pwm = "PWM";
+const char* g_input = "Input";
+
+const int g_numLasers = 6;
+const int g_numPWM = 6;
+const int g_numAnalog = 8;
+
+class Workload
+{
+public:
+	Workload(CMMCore& core, const char* name) : core_(core), name_(name), calls_(0) {}
+	virtual ~Workload() {}
+
+	// one operation, returns the number of property calls
+	virtual int Run(long iteration) = 0;
+
+	void Measure(long iterations)
+	{
+		core_.setProperty(g_hub, "Metrics", "Reset");
+
+		std::vector<double> latencies;
+		latencies.reserve(iterations);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(long i=0;i<iterations;i++){
+			std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+			calls_ += Run(i);
+			latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count());
+		}
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		const double sent = atof(core_.getProperty(g_hub, "Metrics bytes sent").c_str());
+		const double received = atof(core_.getProperty(g_hub, "Metrics bytes received").c_str());
+
+		std::sort(latencies.begin(), latencies.end());
+		printf("%-24s %12.0f %10.1f %10.1f %10.1f %10.1f\n", name_.c_str(),
+			calls_ / elapsed,
+			Percentile(latencies, 0.5), Percentile(latencies, 0.99),
+			sent / iterations, received / iterations);
+	}
+
+protected:
+	CMMCore& core_;
+
+private:
+	static double Percentile(const std::vector<double>& sorted, double fraction)
+	{
+		if (sorted.empty())
+			return 0.;
+		size_t i = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+		return sorted[i];
+	}
+
+	std::string name_;
+	long calls_;
+};
+
+// Reads every property of every device, as a GUI refresh does
+class StatusRefresh : public Workload
+{
+public:
+	StatusRefresh(CMMCore& core) : Workload(core, "Full status refresh") {}
+
+	int Run(long)
+	{
+		const char* devices[] = {g_hub, g_lasers, g_ttl, g_servos, g_pwm, g_input};
+		int calls = 0;
+		for(int d=0;d<6;d++){
+			std::vector<std::string> names = core_.getDevicePropertyNames(devices[d]);
+			for(size_t i=0;i<names.size();i++){
+				core_.getProperty(devices[d], names[i].c_str());
+				calls++;
+			}
+		}
+		return calls;
+	}
+};
+
+// Alternates between two illumination schemes on all lasers
+class LaserSchemeSwitch : public Workload
+{
+public:
+	LaserSchemeSwitch(CMMCore& core) : Workload(core, "Laser-scheme switch") {}
+
+	int Run(long iteration)
+	{
+		const bool odd = (iteration % 2) != 0;
+		for(int i=0;i<g_numLasers;i++){
+			std::ostringstream mode, duration, sequence;
+			mode << "Mode" << i;
+			duration << "Duration" << i;
+			sequence << "Sequence" << i;
+
+			core_.setProperty(g_lasers, mode.str().c_str(), odd ? 3L : 1L);
+			core_.setProperty(g_lasers, duration.str().c_str(), odd ? 2000L : 5000L);
+			core_.setProperty(g_lasers, sequence.str().c_str(), odd ? 43690L : 65535L);
+		}
+		core_.waitForDevice(g_lasers);
+		return 3 * g_numLasers;
+	}
+};
+
+// Drags a PWM slider over its full range
+class PWMSweep : public Workload
+{
+public:
+	PWMSweep(CMMCore& core) : Workload(core, "PWM slider sweep") {}
+
+	int Run(long iteration)
+	{
+		core_.setProperty(g_pwm, "Position0", iteration % 256);
+		core_.waitForDevice(g_pwm);
+		return 1;
+	}
+};
+
+// Reads all analog inputs
+class AnalogPoll : public Workload
+{
+public:
+	AnalogPoll(CMMCore& core) : Workload(core, "8-channel analog poll") {}
+
+	int Run(long)
+	{
+		for(int i=0;i<g_numAnalog;i++){
+			std::ostringstream name;
+			name << "AnalogInput" << i;
+			core_.getProperty(g_input, name.str().c_str());
+		}
+		return g_numAnalog;
+	}
+};
+
+void LoadDevices(CMMCore& core, double transactionUs, double byteUs)
+{
+	core.loadDevice(g_hub, "MicroMojo", "Mojo-Hub");
+	core.setProperty(g_hub, "Transport", "Simulator v1");
+	core.setProperty(g_hub, "Simulator transaction latency (us)", transactionUs);
+	core.setProperty(g_hub, "Simulator byte latency (us)", byteUs);
+	core.initializeDevice(g_hub);
+
+	const char* labels[] = {g_lasers, g_ttl, g_servos, g_pwm, g_input};
+	const char* names[] = {"Mojo-LaserTrig", "Mojo-TTL", "Mojo-Servos", "Mojo-PWM", "Mojo-Input"};
+	for(int i=0;i<5;i++){
+		core.loadDevice(labels[i], "MicroMojo", names[i]);
+		core.setParentLabel(labels[i], g_hub);
+	}
+
+	core.setProperty(g_lasers, "Number of lasers", static_cast<long>(g_numLasers));
+	core.setProperty(g_ttl, "Number of channels", 6L);
+	core.setProperty(g_servos, "Number of Servos", 6L);
+	core.setProperty(g_pwm, "Number of PWM", static_cast<long>(g_numPWM));
+	core.setProperty(g_input, "Number of channels", static_cast<long>(g_numAnalog));
+
+	for(int i=0;i<5;i++){
+		core.initializeDevice(labels[i]);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const long iterations = argc > 1 ? atol(argv[1]) : 1000;
+	const double transactionUs = argc > 2 ? atof(argv[2]) : 0.;
+	const double byteUs = argc > 3 ? atof(argv[3]) : 0.;
+
+	CMMCore core;
+	core.enableStderrLog(false);
+
+	std::vector<std::string> paths;
+	paths.push_back(".");
+	paths.push_back(".libs");
+	core.setDeviceAdapterSearchPaths(paths);
+
+	try {
+		LoadDevices(core, transactionUs, byteUs);
+
+		printf("%ld iterations, transaction latency %.1f us, byte latency %.1f us\n\n", iterations, transactionUs, byteUs);
+		printf("%-24s %12s %10s %10s %10s %10s\n", "workload", "calls/s", "p50 (us)", "p99 (us)", "sent (B)", "recv (B)");
+
+		StatusRefresh refresh(core);
+		LaserSchemeSwitch scheme(core);
+		PWMSweep sweep(core);
+		AnalogPoll poll(core);
+
+		Workload* workloads[] = {&refresh, &scheme, &sweep, &poll};
+		for(int i=0;i<4;i++){
+			workloads[i]->Measure(iterations);
+		}
+
+		core.unloadAllDevices();
+	}
+	catch (CMMError& e) {
+		fprintf(stderr, "%s\n", e.getMsg().c_str());
+		return 1;
+	}
+
+	return 0;
+}
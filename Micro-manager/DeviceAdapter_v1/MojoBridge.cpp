@@ -0,0 +1,174 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoBridge.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   TCP bridge to a Mojo board, for the hub "TCP bridge" transport
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+// Runs on the computer the board is plugged in and forwards the reg_interface
+// bytes between one TCP client (the Mojo hub) and the board:
+//
+//    MojoBridge <tcp port> <tty device | simulator-v1 | simulator-v3> [bind address]
+//
+// The bytes are forwarded unchanged in both directions by two threads, so
+// that any number of requests can be in flight. The simulators give a local
+// loopback bridge for testing. POSIX only (the board side is a MojoTty).
+//
+// The bridge has no authentication: anyone reaching the port drives the
+// board. It listens on the loopback interface (127.0.0.1) unless a bind
+// address is given. Reach it from another computer through an SSH tunnel
+// (ssh -L 5555:localhost:5555 <board computer>), or bind it to a network
+// interface only behind a firewall that restricts the port to trusted hosts.
+//
+
+#include "MojoSimulator.h"
+#include "MojoTty.h"
+#include "../../MMDevice/MMDevice.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Board to client, until the client is gone
+void ForwardAnswers(MojoTransport* board, int client, std::atomic<bool>* connected)
+{
+	unsigned char buffer[4096];
+	while (*connected){
+		if (!board->WaitReadable(100.))
+			continue;
+
+		unsigned long bytesRead;
+		if (board->Read(buffer, sizeof(buffer), bytesRead) != DEVICE_OK){
+			fprintf(stderr, "board read failed\n");
+			*connected = false;
+			break;
+		}
+
+		unsigned long sent = 0;
+		while (sent < bytesRead){
+			ssize_t n = send(client, buffer + sent, bytesRead - sent, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0){
+				*connected = false;
+				break;
+			}
+			sent += static_cast<unsigned long>(n);
+		}
+	}
+}
+
+// Client to board, until the client disconnects
+void ForwardRequests(MojoTransport* board, int client, std::atomic<bool>* connected)
+{
+	unsigned char buffer[4096];
+	while (*connected){
+		struct pollfd p;
+		p.fd = client;
+		p.events = POLLIN;
+		p.revents = 0;
+		if (poll(&p, 1, 100) <= 0)
+			continue;
+
+		ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		if (board->Write(buffer, static_cast<unsigned long>(n)) != DEVICE_OK){
+			fprintf(stderr, "board write failed\n");
+			break;
+		}
+	}
+	*connected = false;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3){
+		fprintf(stderr, "usage: %s <tcp port> <tty device | simulator-v1 | simulator-v3> [bind address]\n", argv[0]);
+		return 1;
+	}
+
+	const int port = atoi(argv[1]);
+	const std::string target = argv[2];
+	const std::string bindAddress = argc > 3 ? argv[3] : "127.0.0.1";
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(static_cast<unsigned short>(port));
+	if (inet_pton(AF_INET, bindAddress.c_str(), &address.sin_addr) != 1){
+		fprintf(stderr, "invalid bind address %s\n", bindAddress.c_str());
+		return 1;
+	}
+
+	MojoTransport* board;
+	if (target == "simulator-v1"){
+		board = new MojoSimulator(MojoSimulator::Layout_v1);
+	} else if (target == "simulator-v3"){
+		board = new MojoSimulator(MojoSimulator::Layout_v3);
+	} else {
+		MojoTty* tty = new MojoTty;
+		if (tty->Open(target) != DEVICE_OK){
+			fprintf(stderr, "cannot open %s\n", target.c_str());
+			return 1;
+		}
+		board = tty;
+	}
+
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	if (bind(server, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 || listen(server, 1) != 0){
+		fprintf(stderr, "cannot listen on %s:%d\n", bindAddress.c_str(), port);
+		return 1;
+	}
+	printf("forwarding %s:%d to %s\n", bindAddress.c_str(), port, target.c_str());
+	fflush(stdout);
+
+	// one client at a time
+	for(;;){
+		int client = accept(server, 0, 0);
+		if (client < 0){
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		int noDelay = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		// answers of a previous client are not for this one
+		board->Purge();
+
+		std::atomic<bool> connected(true);
+		std::thread answers(ForwardAnswers, board, client, &connected);
+		ForwardRequests(board, client, &connected);
+		answers.join();
+
+		close(client);
+	}
+
+	close(server);
+	delete board;
+	return 0;
+}
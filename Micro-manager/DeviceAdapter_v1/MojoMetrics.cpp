@@ -0,0 +1,229 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoMetrics.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Transaction counters and latency histograms of the Mojo hub
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+
+
+#include "MojoMetrics.h"
+#include "MicroMojo.h"
+#include <fstream>
+#include <sstream>
+
+MojoMetrics::MojoMetrics()
+{
+	Reset();
+}
+
+void MojoMetrics::Reset()
+{
+	for(int op=0;op<NumOperations;op++){
+		for(int range=0;range<NumRanges;range++){
+			Clear(latency_[op][range]);
+		}
+	}
+	for(int time=0;time<NumLockTimes;time++){
+		for(int client=0;client<NumClients;client++){
+			Clear(lock_[time][client]);
+		}
+	}
+	bytesSent_ = 0;
+	bytesReceived_ = 0;
+	timeouts_ = 0;
+	unknownCommands_ = 0;
+}
+
+void MojoMetrics::Clear(Histogram& h)
+{
+	for(int i=0;i<numBuckets;i++){
+		h.buckets[i] = 0;
+	}
+	h.count = 0;
+	h.totalUs = 0;
+}
+
+void MojoMetrics::Record(Histogram& h, double us)
+{
+	int bucket = 0;
+	for(double limit=1.;us >= limit && bucket < numBuckets-1;limit*=2.){
+		bucket++;
+	}
+
+	h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	h.count.fetch_add(1, std::memory_order_relaxed);
+	h.totalUs.fetch_add(static_cast<unsigned long long>(us), std::memory_order_relaxed);
+}
+
+void MojoMetrics::RecordTransaction(Operation op, Range range, unsigned long bytesSent, unsigned long bytesReceived, double latencyUs)
+{
+	Record(latency_[op][range], latencyUs);
+
+	bytesSent_.fetch_add(bytesSent, std::memory_order_relaxed);
+	bytesReceived_.fetch_add(bytesReceived, std::memory_order_relaxed);
+}
+
+void MojoMetrics::RecordLock(Client client, double waitUs, double holdUs)
+{
+	Record(lock_[LockWait][client], waitUs);
+	Record(lock_[LockHold][client], holdUs);
+}
+
+unsigned long long MojoMetrics::GetTransactions(Operation op) const
+{
+	unsigned long long total = 0;
+	for(int range=0;range<NumRanges;range++){
+		total += latency_[op][range].count.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+double MojoMetrics::GetPercentile(const Histogram& h, double fraction) const
+{
+	// upper bound of the bucket holding the percentile
+	const unsigned long long count = h.count.load(std::memory_order_relaxed);
+	if (count == 0)
+		return 0.;
+
+	unsigned long long cumulated = 0;
+	double limit = 1.;
+	for(int i=0;i<numBuckets;i++){
+		cumulated += h.buckets[i].load(std::memory_order_relaxed);
+		if (cumulated >= fraction * count)
+			return limit;
+		limit *= 2.;
+	}
+	return limit;
+}
+
+std::string MojoMetrics::FormatLatency(Operation op, Range range) const
+{
+	return Format(latency_[op][range]);
+}
+
+std::string MojoMetrics::FormatLockTime(LockTime time, Client client) const
+{
+	return Format(lock_[time][client]);
+}
+
+std::string MojoMetrics::Format(const Histogram& h) const
+{
+	const unsigned long long count = h.count.load(std::memory_order_relaxed);
+
+	std::ostringstream os;
+	os << "n=" << count;
+	if (count > 0){
+		os << " mean=" << h.totalUs.load(std::memory_order_relaxed) / count << "us"
+			<< " p50<=" << GetPercentile(h, 0.5) << "us"
+			<< " p99<=" << GetPercentile(h, 0.99) << "us";
+	}
+	return os.str();
+}
+
+int MojoMetrics::Dump(const std::string& path) const
+{
+	std::ofstream file(path.c_str());
+	if (!file)
+		return ERR_METRICS_FILE;
+
+	file << "transactions_read " << GetTransactions(Read) << "\n";
+	file << "transactions_write " << GetTransactions(Write) << "\n";
+	file << "bytes_sent " << GetBytesSent() << "\n";
+	file << "bytes_received " << GetBytesReceived() << "\n";
+	file << "timeouts " << GetTimeouts() << "\n";
+	file << "unknown_commands " << GetUnknownCommands() << "\n";
+
+	// one line per histogram: operation, range, count, total time, then the
+	// bucket counts from <1us to <2^(numBuckets-1)us
+	for(int op=0;op<NumOperations;op++){
+		for(int range=0;range<NumRanges;range++){
+			const Histogram& h = latency_[op][range];
+			file << "latency_us " << GetOperationName(static_cast<Operation>(op))
+				<< " " << GetRangeName(static_cast<Range>(range))
+				<< " " << h.count.load(std::memory_order_relaxed)
+				<< " " << h.totalUs.load(std::memory_order_relaxed);
+			for(int i=0;i<numBuckets;i++){
+				file << " " << h.buckets[i].load(std::memory_order_relaxed);
+			}
+			file << "\n";
+		}
+	}
+
+	// then one line per lock histogram: wait or hold, device type, and the
+	// same fields
+	for(int time=0;time<NumLockTimes;time++){
+		for(int client=0;client<NumClients;client++){
+			const Histogram& h = lock_[time][client];
+			file << "lock_us " << GetLockTimeName(static_cast<LockTime>(time))
+				<< " " << GetClientName(static_cast<Client>(client))
+				<< " " << h.count.load(std::memory_order_relaxed)
+				<< " " << h.totalUs.load(std::memory_order_relaxed);
+			for(int i=0;i<numBuckets;i++){
+				file << " " << h.buckets[i].load(std::memory_order_relaxed);
+			}
+			file << "\n";
+		}
+	}
+
+	return file ? DEVICE_OK : ERR_METRICS_FILE;
+}
+
+const char* MojoMetrics::GetOperationName(Operation op)
+{
+	return op == Read ? "read" : "write";
+}
+
+const char* MojoMetrics::GetRangeName(Range range)
+{
+	switch (range){
+	case Laser:
+		return "laser";
+	case TTL:
+		return "ttl";
+	case Servo:
+		return "servo";
+	case PWM:
+		return "pwm";
+	case Camera:
+		return "camera";
+	case Analog:
+		return "analog";
+	case Version:
+		return "version";
+	default:
+		return "other";
+	}
+}
+
+const char* MojoMetrics::GetLockTimeName(LockTime time)
+{
+	return time == LockWait ? "wait" : "hold";
+}
+
+const char* MojoMetrics::GetClientName(Client client)
+{
+	switch (client){
+	case ClientLaserTrig:
+		return "laser-trigger";
+	case ClientLaserShutter:
+		return "laser-shutter";
+	case ClientTTL:
+		return "ttl";
+	case ClientPWM:
+		return "pwm";
+	case ClientServos:
+		return "servos";
+	case ClientInput:
+		return "input";
+	case ClientCameraTrigger:
+		return "camera-trigger";
+	default:
+		return "hub";
+	}
+}
@@ -0,0 +1,80 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoMetrics.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Transaction counters and latency histograms of the Mojo hub
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+
+#ifndef _MojoMetrics_H_
+#define _MojoMetrics_H_
+
+#include <atomic>
+#include <string>
+
+//////////////////////////////////////////////////////////////////////////////
+// Counters are updated with relaxed atomic increments from the I/O path.
+// Latencies are kept in log2 histograms: bucket 0 counts transactions shorter
+// than 1 us, bucket i those between 2^(i-1) and 2^i us. The time spent
+// waiting for the I/O lock of the hub and holding it is kept in the same
+// histograms, per type of device issuing the transactions.
+//
+class MojoMetrics
+{
+public:
+   enum Operation { Read, Write, NumOperations };
+   enum Range { Laser, TTL, Servo, PWM, Camera, Analog, Version, Other, NumRanges };
+   enum Client { ClientHub, ClientLaserTrig, ClientLaserShutter, ClientTTL, ClientPWM, ClientServos, ClientInput, ClientCameraTrigger, NumClients };
+   enum LockTime { LockWait, LockHold, NumLockTimes };
+   static const int numBuckets = 24;
+
+   MojoMetrics();
+
+   void Reset();
+   void RecordTransaction(Operation op, Range range, unsigned long bytesSent, unsigned long bytesReceived, double latencyUs);
+   void RecordTimeout() {timeouts_.fetch_add(1, std::memory_order_relaxed);}
+   void RecordUnknownCommand() {unknownCommands_.fetch_add(1, std::memory_order_relaxed);}
+   void RecordLock(Client client, double waitUs, double holdUs);
+
+   unsigned long long GetTransactions(Operation op) const;
+   unsigned long long GetBytesSent() const {return bytesSent_.load(std::memory_order_relaxed);}
+   unsigned long long GetBytesReceived() const {return bytesReceived_.load(std::memory_order_relaxed);}
+   unsigned long long GetTimeouts() const {return timeouts_.load(std::memory_order_relaxed);}
+   unsigned long long GetUnknownCommands() const {return unknownCommands_.load(std::memory_order_relaxed);}
+
+   std::string FormatLatency(Operation op, Range range) const;
+   std::string FormatLockTime(LockTime time, Client client) const;
+   int Dump(const std::string& path) const;
+
+   static const char* GetOperationName(Operation op);
+   static const char* GetRangeName(Range range);
+   static const char* GetLockTimeName(LockTime time);
+   static const char* GetClientName(Client client);
+
+private:
+   struct Histogram
+   {
+      std::atomic<unsigned long long> buckets[numBuckets];
+      std::atomic<unsigned long long> count;
+      std::atomic<unsigned long long> totalUs;
+   };
+
+   static void Record(Histogram& h, double us);
+   static void Clear(Histogram& h);
+   std::string Format(const Histogram& h) const;
+   double GetPercentile(const Histogram& h, double fraction) const;
+
+   Histogram latency_[NumOperations][NumRanges];
+   Histogram lock_[NumLockTimes][NumClients];
+   std::atomic<unsigned long long> bytesSent_;
+   std::atomic<unsigned long long> bytesReceived_;
+   std::atomic<unsigned long long> timeouts_;
+   std::atomic<unsigned long long> unknownCommands_;
+};
+
+#endif
@@ -0,0 +1,298 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoRecorder.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Memory-mapped binary log of the Mojo analog inputs
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+
+
+#include "MojoRecorder.h"
+#include "MicroMojo.h"
+#include <atomic>
+#include <cstring>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Size of the mapped part of the file, a multiple of the allocation
+// granularity on all platforms. The file grows by the same amount.
+const uint64_t g_windowSize = 4 << 20;
+
+MojoRecorder::MojoRecorder() :
+	header_(0),
+	window_(0),
+	windowOffset_(0),
+	writeOffset_(0),
+	fileSize_(0),
+	records_(0),
+	channelCount_(0),
+	decimation_(1),
+	recordSize_(0),
+	blockSamples_(0),
+	blockTimeUs_(0),
+#ifdef WIN32
+	file_(INVALID_HANDLE_VALUE),
+	mapping_(NULL)
+#else
+	file_(-1)
+#endif
+{
+}
+
+MojoRecorder::~MojoRecorder()
+{
+	Close();
+}
+
+int MojoRecorder::Open(const std::string& path, unsigned long channelMask, long decimation, const MM::MMTime& start)
+{
+	Close();
+
+	channelCount_ = 0;
+	for(int i=0;i<maxChannels;i++){
+		if (channelMask & (1 << i)){
+			channels_[channelCount_++] = i;
+		}
+	}
+	if (channelCount_ == 0 || decimation < 1)
+		return DEVICE_INVALID_PROPERTY_VALUE;
+
+	decimation_ = decimation;
+	recordSize_ = sizeof(int64_t) + channelCount_ * (decimation_ > 1 ? sizeof(float) + 2*sizeof(uint16_t) : sizeof(uint16_t));
+	blockSamples_ = 0;
+	fileSize_ = 0;
+	records_ = 0;
+
+#ifdef WIN32
+	file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_ == INVALID_HANDLE_VALUE)
+		return ERR_RECORDING_FAILED;
+#else
+	file_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file_ < 0)
+		return ERR_RECORDING_FAILED;
+#endif
+
+	int ret = Resize(g_windowSize);
+	if (ret != DEVICE_OK){
+		Close();
+		return ret;
+	}
+
+	// the header has its own mapping, it stays mapped while the window moves
+#ifdef WIN32
+	header_ = static_cast<MojoRecordingHeader*>(MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, sizeof(MojoRecordingHeader)));
+#else
+	void* header = mmap(0, sizeof(MojoRecordingHeader), PROT_READ | PROT_WRITE, MAP_SHARED, file_, 0);
+	header_ = header == MAP_FAILED ? 0 : static_cast<MojoRecordingHeader*>(header);
+#endif
+	if (header_ == 0){
+		Close();
+		return ERR_RECORDING_FAILED;
+	}
+
+	memset(header_, 0, sizeof(MojoRecordingHeader));
+	memcpy(header_->magic, "MOJOREC1", 8);
+	header_->headerSize = sizeof(MojoRecordingHeader);
+	header_->channelMask = static_cast<uint32_t>(channelMask & ((1 << maxChannels) - 1));
+	header_->channelCount = channelCount_;
+	header_->decimation = static_cast<uint32_t>(decimation_);
+	header_->recordSize = static_cast<uint32_t>(recordSize_);
+	header_->startTimeUs = static_cast<int64_t>(start.getUsec());
+	header_->recordCount = 0;
+
+	writeOffset_ = sizeof(MojoRecordingHeader);
+	return MapWindow(0);
+}
+
+void MojoRecorder::Close()
+{
+	UnmapWindow();
+
+	if (header_){
+#ifdef WIN32
+		FlushViewOfFile(header_, 0);
+		UnmapViewOfFile(header_);
+#else
+		munmap(header_, sizeof(MojoRecordingHeader));
+#endif
+		header_ = 0;
+	}
+
+	// drop the pre-extended part of the file
+#ifdef WIN32
+	if (mapping_ != NULL){
+		CloseHandle(mapping_);
+		mapping_ = NULL;
+	}
+	if (file_ != INVALID_HANDLE_VALUE){
+		LARGE_INTEGER size;
+		size.QuadPart = static_cast<LONGLONG>(writeOffset_);
+		SetFilePointerEx(file_, size, NULL, FILE_BEGIN);
+		SetEndOfFile(file_);
+		CloseHandle(file_);
+		file_ = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (file_ >= 0){
+		if (ftruncate(file_, static_cast<off_t>(writeOffset_)) != 0){
+			// keep the pre-extended file, recordCount is still correct
+		}
+		close(file_);
+		file_ = -1;
+	}
+#endif
+
+	writeOffset_ = 0;
+	fileSize_ = 0;
+}
+
+int MojoRecorder::Add(const long* values, const MM::MMTime& time)
+{
+	if (!IsOpen())
+		return DEVICE_OK;
+
+	const int64_t timeUs = static_cast<int64_t>(time.getUsec());
+	unsigned char record[sizeof(int64_t) + maxChannels * (sizeof(float) + 2*sizeof(uint16_t))];
+	size_t pos = 0;
+
+	if (decimation_ == 1){
+		memcpy(record, &timeUs, sizeof(int64_t));
+		pos += sizeof(int64_t);
+		for(int i=0;i<channelCount_;i++){
+			const uint16_t value = static_cast<uint16_t>(values[channels_[i]]);
+			memcpy(record + pos, &value, sizeof(uint16_t));
+			pos += sizeof(uint16_t);
+		}
+	} else {
+		// accumulate the block, a record is written every <decimation> samples
+		for(int i=0;i<channelCount_;i++){
+			const long value = values[channels_[i]];
+			if (blockSamples_ == 0){
+				sum_[i] = 0.;
+				min_[i] = value;
+				max_[i] = value;
+			}
+			sum_[i] += value;
+			if (value < min_[i])
+				min_[i] = value;
+			if (value > max_[i])
+				max_[i] = value;
+		}
+		if (blockSamples_ == 0)
+			blockTimeUs_ = timeUs;
+
+		if (++blockSamples_ < decimation_)
+			return DEVICE_OK;
+		blockSamples_ = 0;
+
+		memcpy(record, &blockTimeUs_, sizeof(int64_t));
+		pos += sizeof(int64_t);
+		for(int i=0;i<channelCount_;i++){
+			const float mean = static_cast<float>(sum_[i] / decimation_);
+			const uint16_t low = static_cast<uint16_t>(min_[i]);
+			const uint16_t high = static_cast<uint16_t>(max_[i]);
+			memcpy(record + pos, &mean, sizeof(float));
+			pos += sizeof(float);
+			memcpy(record + pos, &low, sizeof(uint16_t));
+			pos += sizeof(uint16_t);
+			memcpy(record + pos, &high, sizeof(uint16_t));
+			pos += sizeof(uint16_t);
+		}
+	}
+
+	int ret = Append(record, pos);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	// publish the record to readers once its bytes are in the file
+	std::atomic_thread_fence(std::memory_order_release);
+	header_->recordCount = ++records_;
+
+	return DEVICE_OK;
+}
+
+int MojoRecorder::Append(const unsigned char* data, size_t length)
+{
+	while (length > 0){
+		if (window_ == 0 || writeOffset_ >= windowOffset_ + g_windowSize){
+			int ret = MapWindow(writeOffset_ - writeOffset_ % g_windowSize);
+			if (ret != DEVICE_OK)
+				return ret;
+		}
+
+		size_t n = static_cast<size_t>(windowOffset_ + g_windowSize - writeOffset_);
+		if (n > length)
+			n = length;
+
+		memcpy(window_ + (writeOffset_ - windowOffset_), data, n);
+		writeOffset_ += n;
+		data += n;
+		length -= n;
+	}
+
+	return DEVICE_OK;
+}
+
+int MojoRecorder::MapWindow(uint64_t offset)
+{
+	UnmapWindow();
+
+	if (offset + g_windowSize > fileSize_){
+		int ret = Resize(offset + g_windowSize);
+		if (ret != DEVICE_OK)
+			return ret;
+	}
+
+#ifdef WIN32
+	window_ = static_cast<unsigned char*>(MapViewOfFile(mapping_, FILE_MAP_WRITE, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), static_cast<SIZE_T>(g_windowSize)));
+#else
+	void* window = mmap(0, g_windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, file_, static_cast<off_t>(offset));
+	window_ = window == MAP_FAILED ? 0 : static_cast<unsigned char*>(window);
+#endif
+	if (window_ == 0)
+		return ERR_RECORDING_FAILED;
+
+	windowOffset_ = offset;
+	return DEVICE_OK;
+}
+
+void MojoRecorder::UnmapWindow()
+{
+	if (window_ == 0)
+		return;
+
+#ifdef WIN32
+	UnmapViewOfFile(window_);
+#else
+	munmap(window_, g_windowSize);
+#endif
+	window_ = 0;
+}
+
+int MojoRecorder::Resize(uint64_t size)
+{
+#ifdef WIN32
+	// a mapping object cannot grow, views of the previous one remain valid
+	if (mapping_ != NULL)
+		CloseHandle(mapping_);
+	mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), NULL);
+	if (mapping_ == NULL)
+		return ERR_RECORDING_FAILED;
+#else
+	if (ftruncate(file_, static_cast<off_t>(size)) != 0)
+		return ERR_RECORDING_FAILED;
+#endif
+
+	fileSize_ = size;
+	return DEVICE_OK;
+}
@@ -0,0 +1,101 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoRecorder.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Memory-mapped binary log of the Mojo analog inputs
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+// File layout (little endian):
+//
+//    MojoRecordingHeader (64 bytes), followed by recordCount records.
+//
+//    decimation == 1, one record per sample:
+//       int64 time (us), then for each recorded channel: uint16 value
+//    decimation > 1, one record per block of <decimation> samples:
+//       int64 time of the first sample (us), then for each recorded
+//       channel: float32 mean, uint16 min, uint16 max
+//
+// The file is pre-extended and mapped in windows of fixed size, recordCount
+// is updated after each record so that the file can be read while written.
+//
+
+#ifndef _MojoRecorder_H_
+#define _MojoRecorder_H_
+
+#include "../../MMDevice/MMDevice.h"
+#include <stdint.h>
+#include <string>
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+struct MojoRecordingHeader
+{
+   char magic[8];             // "MOJOREC1"
+   uint32_t headerSize;
+   uint32_t channelMask;      // bit i set if channel i is recorded
+   uint32_t channelCount;
+   uint32_t decimation;       // samples per record, 1 for raw samples
+   uint32_t recordSize;       // in bytes
+   uint32_t reserved;
+   int64_t startTimeUs;
+   volatile uint64_t recordCount;
+   uint8_t padding[16];
+};
+
+
+class MojoRecorder
+{
+public:
+   static const int maxChannels = 8;
+
+   MojoRecorder();
+   ~MojoRecorder();
+
+   int Open(const std::string& path, unsigned long channelMask, long decimation, const MM::MMTime& start);
+   void Close();
+   bool IsOpen() const {return header_ != 0;}
+
+   int Add(const long* values, const MM::MMTime& time);
+   uint64_t GetRecordCount() const {return records_;}
+
+private:
+   int Append(const unsigned char* data, size_t length);
+   int MapWindow(uint64_t offset);
+   void UnmapWindow();
+   int Resize(uint64_t size);
+
+   MojoRecordingHeader* header_;
+   unsigned char* window_;
+   uint64_t windowOffset_;
+   uint64_t writeOffset_;
+   uint64_t fileSize_;
+   uint64_t records_;
+
+   int channels_[maxChannels];
+   int channelCount_;
+   long decimation_;
+   size_t recordSize_;
+
+   // current block when decimating
+   long blockSamples_;
+   int64_t blockTimeUs_;
+   double sum_[maxChannels];
+   long min_[maxChannels];
+   long max_[maxChannels];
+
+#ifdef WIN32
+   HANDLE file_;
+   HANDLE mapping_;
+#else
+   int file_;
+#endif
+};
+
+#endif
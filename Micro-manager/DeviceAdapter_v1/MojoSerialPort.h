@@ -0,0 +1,51 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoSerialPort.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Micro-Manager serial port transport to the Mojo board
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+// Default transport of the hub: the bytes go through the serial port
+// device loaded in Micro-Manager, as with WriteToComPort/ReadFromComPort.
+//
+
+#ifndef _MojoSerialPort_H_
+#define _MojoSerialPort_H_
+
+#include "MojoTransport.h"
+#include "../../MMDevice/MMDevice.h"
+#include <string>
+
+class MojoSerialPort : public MojoTransport
+{
+public:
+   MojoSerialPort(MM::Core* core, const MM::Device* caller, const std::string& port) :
+      core_(core), caller_(caller), port_(port) {}
+
+   int Write(const unsigned char* data, unsigned long length)
+   {
+      return core_->WriteToSerial(caller_, port_.c_str(), data, length);
+   }
+
+   int Read(unsigned char* data, unsigned long maxLength, unsigned long& bytesRead)
+   {
+      return core_->ReadFromSerial(caller_, port_.c_str(), data, maxLength, bytesRead);
+   }
+
+   int Purge()
+   {
+      return core_->PurgeSerial(caller_, port_.c_str());
+   }
+
+private:
+   MM::Core* core_;
+   const MM::Device* caller_;
+   std::string port_;
+};
+
+#endif
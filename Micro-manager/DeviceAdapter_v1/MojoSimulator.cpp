@@ -0,0 +1,489 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoSimulator.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Software model of the Mojo firmware register interface
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+
+
+#include "MojoSimulator.h"
+#include "../../MMDevice/MMDevice.h"
+#include <algorithm>
+#include <thread>
+
+// marker of the framed requests (reg_frame_interface.luc)
+const unsigned char g_frameMarker = 0xA5;
+
+MojoSimulator::MojoSimulator(Layout layout) :
+	layout_(layout),
+	registers_(256, 0),
+	transactionUs_(0.),
+	byteUs_(0.),
+	triggerRunning_(false),
+	triggerPeriodUs_(0.),
+	triggerFrames_(0),
+	framesLeft_(0),
+	recordedFrames_(0),
+	frameCounter_(0),
+	recordedScans_(0),
+	sampleCounter_(0),
+	commands_(0),
+	bytesReceived_(0),
+	bytesSent_(0)
+{
+	for(int i=0;i<numAnalogInputs;i++){
+		analog_[i] = 0;
+	}
+
+	// register blocks in the order of the mojo_top.luc if-chain
+	if (layout_ == Layout_v1){
+		AddBlock(0, 6, Storage, 3);			// laser modes
+		AddBlock(10, 6, Storage, 16);		// laser durations
+		AddBlock(20, 6, Storage, 16);		// laser sequences
+		AddBlock(30, 6, Storage, 1);		// TTLs
+		AddBlock(40, 6, Storage, 16);		// servos
+		AddBlock(50, 6, Storage, 8);		// PWMs
+		AddBlock(60, numAnalogInputs, Analog, 16);
+		AddBlock(100, 1, Constant, 32, 1);	// version
+
+		// the v1 chain compares with upper bounds only, addresses between
+		// two blocks are decoded with an out-of-range index: they read as 0
+		decodedEnd_ = 60 + numAnalogInputs;
+		errorCode_ = 38730;
+	} else {
+		AddBlock(0, 8, Storage, 3);			// laser modes
+		AddBlock(8, 8, Storage, 20);		// laser durations
+		AddBlock(16, 8, Storage, 16);		// laser sequences
+		AddBlock(24, 4, Storage, 1);		// TTLs
+		AddBlock(28, 7, Storage, 16);		// servos
+		AddBlock(35, 5, Storage, 8);		// PWMs
+		AddBlock(40, 1, Storage, 1);		// active trigger
+		AddBlock(41, 1, Storage, 1);		// start trigger
+		AddBlock(42, 1, Storage, 20);		// camera pulse
+		AddBlock(43, 1, Storage, 16);		// camera readout
+		AddBlock(44, 1, Storage, 20);		// camera exposure
+		AddBlock(45, 1, Storage, 16);		// laser delay
+		AddBlock(46, numAnalogInputs, Analog, 16);
+		AddBlock(54, 4, Storage, 17);		// TTL sequences
+		AddBlock(58, 1, Storage, 32);		// frames of a burst
+		AddBlock(59, 1, Trigger, 32);		// frames remaining
+		AddBlock(60, 3, Trigger, 32);		// frame counter, timestamps queued, timestamp
+		AddBlock(63, 1, Storage, 8);		// channels streamed
+		AddBlock(64, 1, Storage, 16);		// scans skipped
+		AddBlock(65, 2, Trigger, 32);		// samples queued, sample
+		AddBlock(67, 1, Trigger, 32);		// sequence restart (write-only)
+		AddBlock(200, 1, Constant, 32, 3);	// version
+		AddBlock(201, 1, Constant, 32, 12);	// id
+		AddBlock(202, 1, Constant, 32, 1);	// protocols: framed requests
+
+		decodedEnd_ = 46 + numAnalogInputs;
+		errorCode_ = 11206655;
+	}
+
+	linkFree_ = Clock::now();
+	now_ = linkFree_;
+	epoch_ = linkFree_;
+	streamStart_ = linkFree_;
+}
+
+void MojoSimulator::AddBlock(long base, long count, Kind kind, int bits, long value)
+{
+	Block b;
+	b.base = base;
+	b.count = count;
+	b.kind = kind;
+	b.bits = bits;
+	b.value = value;
+	blocks_.push_back(b);
+}
+
+void MojoSimulator::SetLatency(double transactionUs, double byteUs)
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	transactionUs_ = transactionUs;
+	byteUs_ = byteUs;
+}
+
+int MojoSimulator::Write(const unsigned char* data, unsigned long length)
+{
+	Clock::time_point done;
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+
+		done = std::max(Clock::now(), linkFree_) + Latency(byteUs_ * length);
+		bytesReceived_ += length;
+
+		input_.insert(input_.end(), data, data + length);
+		Decode(done);
+
+		linkFree_ = done;
+	}
+	answered_.notify_all();
+
+	std::this_thread::sleep_until(done);
+	return DEVICE_OK;
+}
+
+int MojoSimulator::Read(unsigned char* data, unsigned long maxLength, unsigned long& bytesRead)
+{
+	bytesRead = 0;
+
+	Clock::time_point ready;
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		if (answers_.empty())
+			return DEVICE_OK;
+		ready = answers_.front().ready;
+	}
+
+	std::this_thread::sleep_until(ready);
+
+	std::lock_guard<std::mutex> guard(mutex_);
+	const Clock::time_point now = Clock::now();
+	while (bytesRead < maxLength && !answers_.empty() && answers_.front().ready <= now){
+		Answer& a = answers_.front();
+		const size_t n = std::min(static_cast<size_t>(maxLength - bytesRead), a.bytes.size() - a.consumed);
+		std::copy(a.bytes.begin() + a.consumed, a.bytes.begin() + a.consumed + n, data + bytesRead);
+		a.consumed += n;
+		bytesRead += static_cast<unsigned long>(n);
+		if (a.consumed == a.bytes.size())
+			answers_.pop_front();
+	}
+	bytesSent_ += bytesRead;
+
+	return DEVICE_OK;
+}
+
+int MojoSimulator::Purge()
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	answers_.clear();
+	return DEVICE_OK;
+}
+
+long MojoSimulator::GetRegister(long address)
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	now_ = Clock::now();
+	UpdateTrigger();
+	UpdateStream();
+	return ReadRegister(address);
+}
+
+void MojoSimulator::SetAnalogInput(int channel, long value)
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	if (channel >= 0 && channel < numAnalogInputs)
+		analog_[channel] = value;
+}
+
+unsigned long long MojoSimulator::GetCommands()
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	return commands_;
+}
+
+unsigned long long MojoSimulator::GetBytesReceived()
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	return bytesReceived_;
+}
+
+unsigned long long MojoSimulator::GetBytesSent()
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	return bytesSent_;
+}
+
+void MojoSimulator::Decode(Clock::time_point& time)
+{
+	size_t pos = 0;
+	for(;;){
+		// framed requests carry the marker and a sequence number before the request
+		const bool framed = layout_ == Layout_v3 && pos < input_.size() && input_[pos] == g_frameMarker;
+		const size_t start = framed ? pos + 2 : pos;
+		if (input_.size() < start + 5)
+			break;
+
+		const unsigned char header = input_[start];
+		const bool write = (header & (1 << 7)) != 0;
+		const bool increment = (header & (1 << 6)) != 0;
+		const long count = (header & 0x3F) + 1;
+		const long address = input_[start+1] | (input_[start+2] << 8) | (input_[start+3] << 16) | (static_cast<long>(input_[start+4]) << 24);
+
+		const size_t length = (start - pos) + (write ? 5 + 4*count : 5);
+		if (input_.size() - pos < length)
+			break;
+
+		time += Latency(transactionUs_);
+		commands_++;
+		now_ = time;
+		UpdateTrigger();
+		UpdateStream();
+
+		Answer a;
+		a.consumed = 0;
+		if (framed){
+			a.bytes.push_back(input_[pos+1]);
+			a.bytes.push_back(static_cast<unsigned char>((header & (1 << 7)) | (header & 0x3F)));
+		}
+
+		bool unknown = false;
+		if (write){
+			for(long i=0;i<count;i++){
+				const unsigned char* word = &input_[start + 5 + 4*i];
+				const long value = word[0] | (word[1] << 8) | (word[2] << 16) | (static_cast<long>(word[3]) << 24);
+				if (!WriteRegister(increment ? address + i : address, value))
+					unknown = true;
+			}
+		} else {
+			for(long i=0;i<count;i++){
+				const long reg = increment ? address + i : address;
+				const long value = ReadRegister(reg);
+				if (!IsReadable(reg))
+					unknown = true;
+				for(int k=0;k<4;k++){
+					a.bytes.push_back(static_cast<unsigned char>((value >> (8*k)) & 0xFF));
+				}
+			}
+		}
+
+		// legacy writes are not answered
+		if (framed)
+			a.bytes.push_back(unknown ? 1 : 0);
+		if (!a.bytes.empty()){
+			a.ready = time + Latency(byteUs_ * a.bytes.size());
+			answers_.push_back(a);
+		}
+
+		pos += length;
+	}
+
+	input_.erase(input_.begin(), input_.begin() + pos);
+}
+
+long MojoSimulator::ReadRegister(long address)
+{
+	const Block* b = FindBlock(address);
+	if (b == 0)
+		return address >= 0 && address < decodedEnd_ ? 0 : errorCode_;
+
+	switch (b->kind){
+	case Analog:
+		return analog_[address - b->base];
+	case Constant:
+		return b->value;
+	case Trigger:
+		if (address == 60)
+			return static_cast<long>(frameCounter_ & 0xFFFFFFFFUL);
+		if (address == 61)
+			return static_cast<long>(timestamps_.size());
+		if (address == 62){
+			// each read removes the oldest timestamp
+			if (timestamps_.empty())
+				return 0;
+			const unsigned long t = timestamps_.front();
+			timestamps_.pop_front();
+			return static_cast<long>(t);
+		}
+		if (address == 65)
+			return static_cast<long>(samples_.size());
+		if (address == 67)
+			return 0;
+		if (address == 66){
+			if (samples_.empty())
+				return 0;
+			const unsigned long w = samples_.front();
+			samples_.pop_front();
+			return static_cast<long>(w);
+		}
+
+		// frames of the burst not completed, the one in progress included
+		if (registers_[58] == 0)
+			return 0;
+		if (!triggerRunning_)
+			return framesLeft_;
+		return triggerFrames_ - CompletedFrames();
+	default:
+		return registers_[address];
+	}
+}
+
+bool MojoSimulator::IsReadable(long address) const
+{
+	return FindBlock(address) != 0 || (address >= 0 && address < decodedEnd_);
+}
+
+bool MojoSimulator::WriteRegister(long address, long value)
+{
+	const Block* b = FindBlock(address);
+	if (layout_ == Layout_v3 && address == 60){
+		// any write clears the frame counter and the timestamps (and restarts
+		// the sequences, which are not simulated)
+		frameCounter_ = 0;
+		timestamps_.clear();
+		return true;
+	}
+	if (layout_ == Layout_v3 && address == 67){
+		// the sequences are not simulated, the restart is accepted
+		return true;
+	}
+	if (b == 0 || b->kind != Storage)
+		return false;
+
+	registers_[address] = b->bits < 32 ? value & ((1L << b->bits) - 1) : value;
+
+	if (layout_ == Layout_v3 && address == 41){
+		if (registers_[41] != 0){
+			StartTrigger();
+		} else if (triggerRunning_){
+			// the frames of the burst not started yet are left
+			framesLeft_ = triggerFrames_ > 0 ? std::max(0L, triggerFrames_ - CompletedFrames() - 1) : 0;
+			triggerRunning_ = false;
+		}
+	} else if (layout_ == Layout_v3 && address == 63){
+		// the channel mask clears the samples and their counter
+		streamStart_ = now_;
+		recordedScans_ = 0;
+		sampleCounter_ = 0;
+		samples_.clear();
+	} else if (layout_ == Layout_v3 && address == 58){
+		// the frames left count from the frame in progress
+		framesLeft_ = registers_[58];
+		if (triggerRunning_)
+			triggerFrames_ = registers_[58] == 0 ? 0 : CompletedFrames() + 1 + registers_[58];
+	}
+	return true;
+}
+
+void MojoSimulator::StartTrigger()
+{
+	// passive trigger: the camera drives the lasers, nothing is counted
+	framesLeft_ = registers_[58];
+	if (registers_[40] == 0){
+		triggerRunning_ = false;
+		return;
+	}
+
+	triggerRunning_ = true;
+	triggerStart_ = now_;
+	triggerPeriodUs_ = std::max(0.01, static_cast<double>(registers_[43] + registers_[44] + registers_[45]));
+	triggerFrames_ = registers_[58];
+	recordedFrames_ = 0;
+}
+
+long MojoSimulator::CompletedFrames() const
+{
+	const double elapsedUs = std::chrono::duration<double, std::micro>(now_ - triggerStart_).count();
+	return static_cast<long>(elapsedUs / triggerPeriodUs_);
+}
+
+void MojoSimulator::RecordFrames()
+{
+	// frames whose exposure started since the last update, a burst has no
+	// frame after its last
+	const double delayUs = static_cast<double>(registers_[45]);
+	const double elapsedUs = std::chrono::duration<double, std::micro>(now_ - triggerStart_).count() - delayUs;
+	if (elapsedUs < 0)
+		return;
+	long started = static_cast<long>(elapsedUs / triggerPeriodUs_) + 1;
+	if (triggerFrames_ > 0)
+		started = std::min(started, triggerFrames_);
+
+	// timestamps are lost while the queue is full
+	for(long k=recordedFrames_;k<started;k++){
+		frameCounter_++;
+		if (timestamps_.size() < timestampEntries_){
+			const Clock::time_point edge = triggerStart_ + Latency(k * triggerPeriodUs_ + delayUs);
+			const double us = std::chrono::duration<double, std::micro>(edge - epoch_).count();
+			timestamps_.push_back(static_cast<unsigned long>(us) & 0xFFFFFFFFUL);
+		} else if (k + 1 < started){
+			// the frames left are counted at once, their timestamps are lost
+			frameCounter_ += started - k - 1;
+			break;
+		}
+	}
+	recordedFrames_ = std::max(recordedFrames_, started);
+}
+
+void MojoSimulator::UpdateTrigger()
+{
+	if (triggerRunning_)
+		RecordFrames();
+
+	// the start register is cleared once the last frame of a burst is over
+	if (triggerRunning_ && triggerFrames_ > 0 && CompletedFrames() >= triggerFrames_){
+		triggerRunning_ = false;
+		framesLeft_ = 0;
+		registers_[41] = 0;
+	}
+}
+
+void MojoSimulator::UpdateStream()
+{
+	if (layout_ != Layout_v3 || registers_[63] == 0)
+		return;
+
+	// scans over since the start, one out of divider + 1 is queued
+	const long long scans = static_cast<long long>(std::chrono::duration<double, std::micro>(now_ - streamStart_).count() / scanPeriodUs);
+	const long long divider = registers_[64] + 1;
+
+	for(long long k=recordedScans_;k<scans;k++){
+		if (k % divider != 0)
+			continue;
+
+		for(int c=0;c<numAnalogInputs;c++){
+			if ((registers_[63] & (1 << c)) == 0)
+				continue;
+
+			// {counter[19], channel[3], value[10]}, samples are lost while the queue is full
+			if (samples_.size() < sampleEntries_)
+				samples_.push_back(((sampleCounter_ & 0x7FFFF) << 13) | (c << 10) | (analog_[c] & 0x3FF));
+			sampleCounter_++;
+		}
+
+		if (samples_.size() >= sampleEntries_){
+			// the scans left are counted at once
+			long channels = 0;
+			for(int c=0;c<numAnalogInputs;c++){
+				channels += (registers_[63] >> c) & 1;
+			}
+			const long long queued = (scans + divider - 1) / divider - (k + divider) / divider;
+			sampleCounter_ += static_cast<unsigned long>(queued * channels);
+			break;
+		}
+	}
+	recordedScans_ = std::max(recordedScans_, scans);
+}
+
+const MojoSimulator::Block* MojoSimulator::FindBlock(long address) const
+{
+	for(size_t i=0;i<blocks_.size();i++){
+		if (address >= blocks_[i].base && address < blocks_[i].base + blocks_[i].count)
+			return &blocks_[i];
+	}
+	return 0;
+}
+
+bool MojoSimulator::WaitReadable(double timeoutMs)
+{
+	const Clock::time_point deadline = Clock::now() + Latency(timeoutMs * 1000.);
+
+	std::unique_lock<std::mutex> guard(mutex_);
+	while (answers_.empty()){
+		if (answered_.wait_until(guard, deadline) == std::cv_status::timeout)
+			return !answers_.empty();
+	}
+	return true;
+}
+
+MojoSimulator::Clock::duration MojoSimulator::Latency(double us) const
+{
+	return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>(us));
+}
@@ -0,0 +1,169 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoSimulator.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Software model of the Mojo firmware register interface
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+// The simulator decodes the reg_interface byte protocol and serves the
+// register map of mojo_top.luc, either the v1 layout (Alchitry_projects/
+// Mojo_v1) or the v3 layout (Alchitry_projects/Mojo_v3):
+//
+//    header byte: write flag (bit 7), auto-increment flag (bit 6) and
+//                 number of words minus one (bits 5:0)
+//    address:     4 bytes, little endian
+//    write data:  4 bytes per word, little endian
+//    read answer: 4 bytes per word, little endian
+//
+// Reads of an unknown address answer with the firmware error code, writes
+// to an unknown address are ignored. Written values are truncated to the
+// width of the firmware registers.
+//
+// The v3 layout also decodes the framed requests of reg_frame_interface.luc:
+// the marker byte, a sequence number and a request as above. Each of them
+// is answered by the sequence number, the write flag (bit 7) and number of
+// words minus one, the words read and a status byte (bit 0: unknown
+// register).
+//
+// The v3 camera trigger is modelled for the frame-counted bursts: with the
+// active trigger, frames start every delay + exposure + readout us (the
+// values at the start) from the time the start register is written, a
+// burst clears the start register once its frames are over. The frames are
+// counted and timestamped when their exposure starts (after the laser delay),
+// in a queue of the depth of the firmware one.
+//
+// The v3 analog sample stream is modelled with an ADC that samples the 8
+// channels every <scan period> us, the samples of the enabled channels are
+// queued from the write of the channel mask.
+//
+// Timing: each command costs <transaction latency>, each byte crossing the
+// link costs <byte latency>. Write blocks until the command bytes are sent
+// and processed, the answers become readable once they had time to travel
+// back; Read waits for the first pending answer, WaitReadable for a request
+// to be answered.
+//
+
+#ifndef _MojoSimulator_H_
+#define _MojoSimulator_H_
+
+#include "MojoTransport.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+class MojoSimulator : public MojoTransport
+{
+public:
+   enum Layout { Layout_v1, Layout_v3 };
+
+   MojoSimulator(Layout layout);
+
+   void SetLatency(double transactionUs, double byteUs);
+   Layout GetLayout() const {return layout_;}
+
+   // MojoTransport
+   int Write(const unsigned char* data, unsigned long length);
+   int Read(unsigned char* data, unsigned long maxLength, unsigned long& bytesRead);
+   int Purge();
+   bool WaitReadable(double timeoutMs);
+
+   // Board side, e.g. for tests: register contents and analog inputs
+   long GetRegister(long address);
+   void SetAnalogInput(int channel, long value);
+
+   unsigned long long GetCommands();
+   unsigned long long GetBytesReceived();
+   unsigned long long GetBytesSent();
+
+   static const int numAnalogInputs = 8;
+   static const int scanPeriodUs = 100;
+
+private:
+   typedef std::chrono::steady_clock Clock;
+
+   enum Kind { Storage, Analog, Constant, Trigger };
+
+   struct Block
+   {
+      long base;
+      long count;
+      Kind kind;
+      int bits;      // width of the firmware registers
+      long value;    // for constants
+   };
+
+   struct Answer
+   {
+      Clock::time_point ready;
+      std::vector<unsigned char> bytes;
+      size_t consumed;
+   };
+
+   void Decode(Clock::time_point& time);
+   void AddBlock(long base, long count, Kind kind, int bits, long value = 0);
+   long ReadRegister(long address);
+   bool IsReadable(long address) const;
+   bool WriteRegister(long address, long value);
+   void StartTrigger();
+   long CompletedFrames() const;
+   void UpdateTrigger();
+   void RecordFrames();
+   void UpdateStream();
+   const Block* FindBlock(long address) const;
+   Clock::duration Latency(double us) const;
+
+   Layout layout_;
+   std::vector<Block> blocks_;
+   long decodedEnd_;       // addresses below are decoded by the firmware if-chain
+   long errorCode_;
+   std::vector<long> registers_;
+   long analog_[numAnalogInputs];
+
+   std::vector<unsigned char> input_;
+   std::deque<Answer> answers_;
+   Clock::time_point linkFree_;
+   double transactionUs_;
+   double byteUs_;
+
+   // camera trigger: start time, period and frames to run since the start
+   // (0 until stopped), frames of the burst left while stopped, time of the
+   // command being decoded
+   bool triggerRunning_;
+   Clock::time_point triggerStart_;
+   double triggerPeriodUs_;
+   long triggerFrames_;
+   long framesLeft_;
+   Clock::time_point now_;
+
+   // frame timestamps: frames of the run already counted, frames counted
+   // since the last clear and the queue of timestamps, in us from the epoch
+   static const size_t timestampEntries_ = 512;
+   long recordedFrames_;
+   unsigned long frameCounter_;
+   std::deque<unsigned long> timestamps_;
+   Clock::time_point epoch_;
+
+   // analog sample stream: start, scans already queued, samples of the
+   // enabled channels since the start (queued or lost) and the queue
+   static const size_t sampleEntries_ = 1024;
+   Clock::time_point streamStart_;
+   long long recordedScans_;
+   unsigned long sampleCounter_;
+   std::deque<unsigned long> samples_;
+
+   unsigned long long commands_;
+   unsigned long long bytesReceived_;
+   unsigned long long bytesSent_;
+
+   std::mutex mutex_;
+   std::condition_variable answered_;
+};
+
+#endif
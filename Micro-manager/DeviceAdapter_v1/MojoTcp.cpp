@@ -0,0 +1,214 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoTcp.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   TCP transport to a Mojo board behind MojoBridge
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+
+
+#include "MojoTcp.h"
+#include "../../MMDevice/MMDevice.h"
+#include <cstring>
+#include <sstream>
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifdef WIN32
+static const MojoTcp::Socket g_noSocket = INVALID_SOCKET;
+
+static void CloseSocket(SOCKET s) {closesocket(s);}
+static bool WouldBlock() {return WSAGetLastError() == WSAEWOULDBLOCK;}
+static bool Interrupted() {return WSAGetLastError() == WSAEINTR;}
+#else
+static const int g_noSocket = -1;
+
+static void CloseSocket(int s) {close(s);}
+static bool WouldBlock() {return errno == EAGAIN || errno == EWOULDBLOCK;}
+static bool Interrupted() {return errno == EINTR;}
+#endif
+
+// Waits until the socket is readable (or writable), returns false on time out
+static bool WaitSocket(MojoTcp::Socket s, bool write, double timeoutMs)
+{
+	const int ms = timeoutMs > 0. ? static_cast<int>(timeoutMs + 0.5) : 0;
+#ifdef WIN32
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(s, &set);
+	timeval tv;
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	return select(0, write ? 0 : &set, write ? &set : 0, 0, &tv) > 0;
+#else
+	struct pollfd p;
+	p.fd = s;
+	p.events = write ? POLLOUT : POLLIN;
+	p.revents = 0;
+
+	int ret;
+	do {
+		ret = poll(&p, 1, ms);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret > 0;
+#endif
+}
+
+MojoTcp::MojoTcp() :
+	socket_(g_noSocket)
+{
+#ifdef WIN32
+	WSADATA data;
+	WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+}
+
+MojoTcp::~MojoTcp()
+{
+	Close();
+#ifdef WIN32
+	WSACleanup();
+#endif
+}
+
+bool MojoTcp::IsOpen() const
+{
+	return socket_ != g_noSocket;
+}
+
+int MojoTcp::Connect(const std::string& host, long port)
+{
+	Close();
+
+	std::ostringstream service;
+	service << port;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo* addresses = 0;
+	if (getaddrinfo(host.c_str(), service.str().c_str(), &hints, &addresses) != 0)
+		return DEVICE_NOT_CONNECTED;
+
+	for(struct addrinfo* a = addresses; a != 0 && socket_ == g_noSocket; a = a->ai_next){
+		Socket s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (s == g_noSocket)
+			continue;
+
+		if (connect(s, a->ai_addr, static_cast<int>(a->ai_addrlen)) != 0){
+			CloseSocket(s);
+			continue;
+		}
+		socket_ = s;
+	}
+	freeaddrinfo(addresses);
+
+	if (socket_ == g_noSocket)
+		return DEVICE_NOT_CONNECTED;
+
+	// requests leave at once, reads never block
+	int noDelay = 1;
+	setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+#ifdef WIN32
+	u_long nonBlocking = 1;
+	ioctlsocket(socket_, FIONBIO, &nonBlocking);
+#else
+	fcntl(socket_, F_SETFL, fcntl(socket_, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	return DEVICE_OK;
+}
+
+void MojoTcp::Close()
+{
+	if (socket_ != g_noSocket){
+		CloseSocket(socket_);
+		socket_ = g_noSocket;
+	}
+}
+
+int MojoTcp::Write(const unsigned char* data, unsigned long length)
+{
+	if (socket_ == g_noSocket)
+		return DEVICE_NOT_CONNECTED;
+
+	unsigned long written = 0;
+	while (written < length){
+		int n = send(socket_, reinterpret_cast<const char*>(data + written), static_cast<int>(length - written), 0);
+		if (n > 0){
+			written += static_cast<unsigned long>(n);
+		} else if (n < 0 && Interrupted()){
+			continue;
+		} else if (n < 0 && WouldBlock()){
+			if (!WaitSocket(socket_, true, 500.))
+				return DEVICE_SERIAL_COMMAND_FAILED;
+		} else {
+			return DEVICE_SERIAL_COMMAND_FAILED;
+		}
+	}
+
+	return DEVICE_OK;
+}
+
+int MojoTcp::Read(unsigned char* data, unsigned long maxLength, unsigned long& bytesRead)
+{
+	bytesRead = 0;
+	if (socket_ == g_noSocket)
+		return DEVICE_NOT_CONNECTED;
+
+	for(;;){
+		int n = recv(socket_, reinterpret_cast<char*>(data), static_cast<int>(maxLength), 0);
+		if (n > 0){
+			bytesRead = static_cast<unsigned long>(n);
+			return DEVICE_OK;
+		}
+		if (n == 0)
+			return DEVICE_NOT_CONNECTED;	// closed by the bridge
+		if (WouldBlock())
+			return DEVICE_OK;
+		if (!Interrupted())
+			return DEVICE_SERIAL_COMMAND_FAILED;
+	}
+}
+
+int MojoTcp::Purge()
+{
+	// drops the bytes already received
+	unsigned char buffer[256];
+	unsigned long bytesRead;
+	do {
+		int ret = Read(buffer, sizeof(buffer), bytesRead);
+		if (ret != DEVICE_OK)
+			return ret;
+	} while (bytesRead > 0);
+
+	return DEVICE_OK;
+}
+
+bool MojoTcp::WaitReadable(double timeoutMs)
+{
+	if (socket_ == g_noSocket)
+		return false;
+	return WaitSocket(socket_, false, timeoutMs);
+}
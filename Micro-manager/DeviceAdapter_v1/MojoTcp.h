@@ -0,0 +1,52 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoTcp.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   TCP transport to a Mojo board behind MojoBridge
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+// MojoBridge runs on the computer the board is plugged in and forwards the
+// reg_interface bytes between a TCP connection and the board, unchanged.
+// The stream carries any number of requests in flight: the pipelined reads
+// of the hub pay the network round trip once per batch of registers.
+// Nagle's algorithm is disabled so that short requests leave at once.
+//
+
+#ifndef _MojoTcp_H_
+#define _MojoTcp_H_
+
+#include "MojoTransport.h"
+#include <string>
+
+class MojoTcp : public MojoTransport
+{
+public:
+   MojoTcp();
+   ~MojoTcp();
+
+   int Connect(const std::string& host, long port);
+   void Close();
+   bool IsOpen() const;
+
+   // MojoTransport
+   int Write(const unsigned char* data, unsigned long length);
+   int Read(unsigned char* data, unsigned long maxLength, unsigned long& bytesRead);
+   int Purge();
+   bool WaitReadable(double timeoutMs);
+
+#ifdef WIN32
+   typedef unsigned long long Socket;  // SOCKET
+#else
+   typedef int Socket;
+#endif
+
+private:
+   Socket socket_;
+};
+
+#endif
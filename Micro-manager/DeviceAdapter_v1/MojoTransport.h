@@ -0,0 +1,40 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoTransport.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Byte stream between the Mojo hub and the board
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+
+#ifndef _MojoTransport_H_
+#define _MojoTransport_H_
+
+//////////////////////////////////////////////////////////////////////////////
+// The hub sends reg_interface commands and reads the answers through this
+// interface when one is set, instead of the Micro-Manager serial port.
+// Calls are serialized by the hub lock.
+//
+class MojoTransport
+{
+public:
+   virtual ~MojoTransport() {}
+
+   virtual int Write(const unsigned char* data, unsigned long length) = 0;
+
+   // returns the bytes available, bytesRead is 0 if there are none
+   virtual int Read(unsigned char* data, unsigned long maxLength, unsigned long& bytesRead) = 0;
+
+   // drops the answers not read yet
+   virtual int Purge() = 0;
+
+   // blocks until bytes can be read or the time out expires, transports
+   // that cannot wait return at once and the hub polls Read
+   virtual bool WaitReadable(double /*timeoutMs*/) {return true;}
+};
+
+#endif
@@ -0,0 +1,187 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoTty.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Native POSIX serial transport to the Mojo board
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+
+
+#include "MojoTty.h"
+#include "../../MMDevice/MMDevice.h"
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+MojoTty::MojoTty() :
+	fd_(-1)
+{
+}
+
+MojoTty::~MojoTty()
+{
+	Close();
+}
+
+#ifndef WIN32
+
+int MojoTty::Open(const std::string& device)
+{
+	Close();
+
+	int fd = open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+		return DEVICE_NOT_CONNECTED;
+
+	// raw mode, 8N1 without flow control. The board is a USB CDC device,
+	// the baud rate is only set to match the Micro-Manager configuration.
+	struct termios tio;
+	if (tcgetattr(fd, &tio) != 0){
+		close(fd);
+		return DEVICE_NOT_CONNECTED;
+	}
+
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, B9600);
+	cfsetospeed(&tio, B9600);
+
+	if (tcsetattr(fd, TCSANOW, &tio) != 0){
+		close(fd);
+		return DEVICE_NOT_CONNECTED;
+	}
+
+	tcflush(fd, TCIOFLUSH);
+	fd_ = fd;
+
+	return DEVICE_OK;
+}
+
+void MojoTty::Close()
+{
+	if (fd_ >= 0){
+		close(fd_);
+		fd_ = -1;
+	}
+}
+
+int MojoTty::Write(const unsigned char* data, unsigned long length)
+{
+	if (fd_ < 0)
+		return DEVICE_NOT_CONNECTED;
+
+	unsigned long written = 0;
+	while (written < length){
+		ssize_t n = write(fd_, data + written, length - written);
+		if (n > 0){
+			written += static_cast<unsigned long>(n);
+		} else if (n < 0 && errno == EINTR){
+			continue;
+		} else if (n < 0 && errno == EAGAIN){
+			// output buffer full, wait until the driver takes more
+			struct pollfd p;
+			p.fd = fd_;
+			p.events = POLLOUT;
+			p.revents = 0;
+			if (poll(&p, 1, 500) <= 0)
+				return DEVICE_SERIAL_COMMAND_FAILED;
+		} else {
+			return DEVICE_SERIAL_COMMAND_FAILED;
+		}
+	}
+
+	return DEVICE_OK;
+}
+
+int MojoTty::Read(unsigned char* data, unsigned long maxLength, unsigned long& bytesRead)
+{
+	bytesRead = 0;
+	if (fd_ < 0)
+		return DEVICE_NOT_CONNECTED;
+
+	for(;;){
+		ssize_t n = read(fd_, data, maxLength);
+		if (n >= 0){
+			bytesRead = static_cast<unsigned long>(n);
+			return DEVICE_OK;
+		}
+		if (errno == EAGAIN)
+			return DEVICE_OK;
+		if (errno != EINTR)
+			return DEVICE_SERIAL_COMMAND_FAILED;
+	}
+}
+
+int MojoTty::Purge()
+{
+	if (fd_ < 0)
+		return DEVICE_NOT_CONNECTED;
+
+	tcflush(fd_, TCIFLUSH);
+	return DEVICE_OK;
+}
+
+bool MojoTty::WaitReadable(double timeoutMs)
+{
+	if (fd_ < 0)
+		return false;
+
+	struct pollfd p;
+	p.fd = fd_;
+	p.events = POLLIN;
+	p.revents = 0;
+
+	int ret;
+	do {
+		ret = poll(&p, 1, timeoutMs > 0. ? static_cast<int>(timeoutMs + 0.5) : 0);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret > 0;
+}
+
+#else
+
+int MojoTty::Open(const std::string& /*device*/)
+{
+	return DEVICE_NOT_SUPPORTED;
+}
+
+void MojoTty::Close()
+{
+}
+
+int MojoTty::Write(const unsigned char* /*data*/, unsigned long /*length*/)
+{
+	return DEVICE_NOT_CONNECTED;
+}
+
+int MojoTty::Read(unsigned char* /*data*/, unsigned long /*maxLength*/, unsigned long& bytesRead)
+{
+	bytesRead = 0;
+	return DEVICE_NOT_CONNECTED;
+}
+
+int MojoTty::Purge()
+{
+	return DEVICE_NOT_CONNECTED;
+}
+
+bool MojoTty::WaitReadable(double /*timeoutMs*/)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,45 @@
+//////////////////////////////////////////////////////////////////////////////
+// FILE:          MojoTty.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Native POSIX serial transport to the Mojo board
+// COPYRIGHT:     EMBL
+// LICENSE:       LGPL
+//
+// AUTHOR:        agent, 2026
+//
+//
+// Opens the tty of the board directly (e.g. /dev/ttyACM0) in raw mode,
+// without the Micro-Manager serial port. Reads never block, the hub waits
+// for the answers in WaitReadable, which sleeps in poll() until bytes
+// arrive or the time out expires. Not available on Windows.
+//
+
+#ifndef _MojoTty_H_
+#define _MojoTty_H_
+
+#include "MojoTransport.h"
+#include <string>
+
+class MojoTty : public MojoTransport
+{
+public:
+   MojoTty();
+   ~MojoTty();
+
+   int Open(const std::string& device);
+   void Close();
+   bool IsOpen() const {return fd_ >= 0;}
+
+   // MojoTransport
+   int Write(const unsigned char* data, unsigned long length);
+   int Read(unsigned char* data, unsigned long maxLength, unsigned long& bytesRead);
+   int Purge();
+   bool WaitReadable(double timeoutMs);
+
+private:
+   int fd_;
+};
+
+#endif